@@ -16,12 +16,17 @@ ModbusTCP = modbustcp_ns.class_("ModbusTCP", cg.Component)
 ModbusDevice = modbustcp_ns.class_("ModbusDevice")
 
 MULTI_CONF = True
+# socket enables USE_SOCKET_SELECT_SUPPORT: the main loop sleeps in select() and wakes up when a response arrives
+AUTO_LOAD = ["socket"]
 # Note: async_tcp AUTO_LOAD removed to support both Arduino and ESP-IDF frameworks
 # Arduino framework can optionally use AsyncTCP (add to lib_deps manually if desired)
 # ESP-IDF framework uses native lwip sockets (no external dependency needed)
 
 CONF_MODBUSTCP_ID = "modbustcp_id"
 CONF_SEND_WAIT_TIME = "send_wait_time"
+CONF_MAX_OUTSTANDING = "max_outstanding"
+CONF_LOOP_BUDGET = "loop_budget"
+CONF_SEND_WEIGHT = "send_weight"
 
 CONFIG_SCHEMA = (
     cv.Schema(
@@ -32,6 +37,10 @@ CONFIG_SCHEMA = (
             cv.Optional(
                 CONF_SEND_WAIT_TIME, default="250ms"
             ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_MAX_OUTSTANDING, default=1): cv.int_range(1, 16),
+            cv.Optional(
+                CONF_LOOP_BUDGET, default="2ms"
+            ): cv.positive_time_period_microseconds,
         }
     )
     .extend(cv.COMPONENT_SCHEMA)
@@ -45,10 +54,13 @@ async def to_code(config):
     cg.add(var.set_host(str(config[CONF_IP_ADDRESS])))
     cg.add(var.set_port(config["port"]))
     cg.add(var.set_send_wait_time(config[CONF_SEND_WAIT_TIME]))
+    cg.add(var.set_max_outstanding(config[CONF_MAX_OUTSTANDING]))
+    cg.add(var.set_loop_budget(config[CONF_LOOP_BUDGET]))
    
 def modbus_device_schema(default_address):
     schema = {
         cv.GenerateID(CONF_MODBUSTCP_ID): cv.use_id(ModbusTCP),
+        cv.Optional(CONF_SEND_WEIGHT, default=1): cv.int_range(1, 16),
     }
     if default_address is None:
         schema[cv.Required(CONF_ADDRESS)] = cv.hex_uint8_t
@@ -61,4 +73,5 @@ async def register_modbus_device(var, config):
     parent = await cg.get_variable(config[CONF_MODBUSTCP_ID])
     cg.add(var.set_parent(parent))
     cg.add(var.set_address(config[CONF_ADDRESS]))
+    cg.add(var.set_send_weight(config[CONF_SEND_WEIGHT]))
     cg.add(parent.register_device(var))
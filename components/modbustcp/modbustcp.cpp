@@ -1,18 +1,22 @@
 #include "modbustcp.h"
+#include "esphome/core/defines.h"
 #include "esphome/core/application.h"
 #include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
 #include "esphome/components/network/util.h"
+#ifdef USE_LOGGER
+#include "esphome/components/logger/logger.h"
+#endif
+
+#include <algorithm>
+#include <cstring>
 
 // Conditional includes based on framework
 #ifdef ARDUINO
-  // Arduino framework uses millis() for timing
   #ifdef ESP32
     #include <Arduino.h>
   #endif
 #else
-  // ESP-IDF framework uses esp_timer
-  #include "esp_timer.h"
   #include <fcntl.h>
 #endif
 
@@ -20,6 +24,10 @@ namespace esphome {
 namespace modbustcp {
 
 static const char *const TAG = "modbustcp";
+#if !defined(MODBUSTCP_USE_ASYNC) && !defined(MODBUSTCP_USE_EPOLL)
+/// recv() interval of an idle connection without main loop select() support
+static const uint32_t IDLE_RECV_INTERVAL = 1000;
+#endif
 
 #ifdef MODBUSTCP_USE_ASYNC
 // ============================================================================
@@ -33,12 +41,20 @@ void ModbusTCP::setup() {
 
 void ModbusTCP::on_async_connect_(void *arg, AsyncClient *client) {
   ESP_LOGD(TAG, "AsyncTCP connected");
+  {
+    LockGuard guard(this->async_rx_lock_);
+    this->async_rx_len_ = 0;
+    this->async_rx_reset_ = true;
+  }
   this->client_ready_ = true;
 }
 
 void ModbusTCP::on_async_disconnect_(void *arg, AsyncClient *client) {
   ESP_LOGD(TAG, "AsyncTCP disconnected");
   this->client_ready_ = false;
+  LockGuard guard(this->async_rx_lock_);
+  this->async_rx_len_ = 0;
+  this->async_rx_reset_ = true;
 }
 
 void ModbusTCP::on_async_error_(void *arg, AsyncClient *client, int8_t error) {
@@ -47,78 +63,47 @@ void ModbusTCP::on_async_error_(void *arg, AsyncClient *client, int8_t error) {
 }
 
 void ModbusTCP::on_async_data_(void *arg, AsyncClient *client, void *data, size_t len) {
-  if (len < 9) {
-    return;  // Minimum Modbus TCP response is 9 bytes
-  }
-  
-  uint8_t *byte1 = static_cast<uint8_t*>(data);
-  
-  std::string res;
-  char buf[5];
-  size_t data_len = byte1[8];
-  for (size_t i = 9; i < data_len + 9 && i < len; i++) {
-    sprintf(buf, "%02X", byte1[i]);
-    res += buf;
-    res += ":"; 
-  }
-  ESP_LOGD(TAG, "<<< %02X%02X %02X%02X %02X%02X %02X %02X %02X %s ",
-                      byte1[0], byte1[1], byte1[2], byte1[3], byte1[4], 
-                      byte1[5], byte1[6], byte1[7], byte1[8], res.c_str());
+  // runs on the AsyncTCP task - only buffer the bytes, loop() parses and dispatches them
+  LockGuard guard(this->async_rx_lock_);
+  size_t accepted = std::min(len, sizeof(this->async_rx_buffer_) - this->async_rx_len_);
+  memcpy(this->async_rx_buffer_ + this->async_rx_len_, data, accepted);
+  this->async_rx_len_ += accepted;
+  this->async_rx_dropped_ += len - accepted;
+}
 
-  // Check for Modbus error response
-  if ((byte1[7] & 0x80) == 0x80) {
-    ESP_LOGE(TAG, "Error:"); 
-    if (byte1[8]  == 0x01) {
-      ESP_LOGE(TAG,"Failure Code 0x01 ILLEGAL FUNCTION");
-    }
-    if (byte1[8]  == 0x02) {
-      ESP_LOGE(TAG,"Failure Code 0x02 ILLEGAL DATA ADDRESS");
-    }
-    if (byte1[8]  == 0x03) {
-      ESP_LOGE(TAG,"Failure Code 0x03 ILLEGAL DATA VALUE");
-    }
-    if (byte1[8]  == 0x04) {
-      ESP_LOGE(TAG,"Failure Code 0x04 SERVER FAILURE");
-    }
-    if (byte1[8]  == 0x05) {
-      ESP_LOGE(TAG,"Failure Code 0x05 ACKNOWLEDGE");
-    }
-    if (byte1[8]  == 0x06) {
-      ESP_LOGE(TAG,"Failure Code 0x06 SERVER BUSY");
-    }
-    return;
+void ModbusTCP::process_async_received_() {
+  size_t len;
+  size_t dropped;
+  bool reset;
+  {
+    LockGuard guard(this->async_rx_lock_);
+    len = this->async_rx_len_;
+    dropped = this->async_rx_dropped_;
+    reset = this->async_rx_reset_;
+    memcpy(this->async_rx_work_, this->async_rx_buffer_, len);
+    this->async_rx_len_ = 0;
+    this->async_rx_dropped_ = 0;
+    this->async_rx_reset_ = false;
   }
 
-  uint8_t bytelen_len = 9;
-  std::vector<uint8_t> modbus_data(byte1 + bytelen_len, byte1 + bytelen_len + data_len);
-
-  ESP_LOGV(TAG, "Incoming Data %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X",
-                      modbus_data[0], modbus_data[1], modbus_data[2], modbus_data[3], modbus_data[4], 
-                      modbus_data[5], modbus_data[6], modbus_data[7], modbus_data[8]);
-  
-  for (auto *device : this->devices_) {
-    device->on_modbus_data(modbus_data);
+  if (reset) {
+    // the connection changed, the buffered bytes all belong to the new one
+    this->rx_parser_.reset();
   }
-  
-  const uint32_t now = millis();
-  if (now - this->last_send_ > send_wait_time_) {
-    if (waiting_for_response > 0) {
-      ESP_LOGD(TAG, "Stop waiting for response from %d", waiting_for_response);
-    }
-    waiting_for_response = 0;
+  if (len > 0) {
+    this->process_received_(this->async_rx_work_, len);
+  }
+  if (dropped > 0) {
+    // the stream is broken behind the buffered bytes, transactions of the lost responses run into their timeout
+    ESP_LOGW(TAG, "Receive buffer overflow - dropped %zu bytes", dropped);
+    this->rx_parser_.reset();
   }
 }
 
 void ModbusTCP::loop() {
-  // AsyncTCP handles everything via callbacks
-  // Just check for timeouts
-  const uint32_t now = millis();
-  if (now - this->last_send_ > send_wait_time_) {
-    if (waiting_for_response > 0) {
-      ESP_LOGD(TAG, "Stop waiting for response from %d", waiting_for_response);
-    }
-    waiting_for_response = 0;
-  }
+  // AsyncTCP receives on its own task, responses are dispatched here
+  this->process_async_received_();
+  this->check_timeouts_(millis());
 }
 
 void ModbusTCP::ensure_tcp_client() {
@@ -170,180 +155,156 @@ void ModbusTCP::ensure_tcp_client() {
   }
 }
 
-void ModbusTCP::send(uint8_t address, uint8_t function_code, uint16_t start_address, uint16_t number_of_entities, uint8_t payload_len, const uint8_t *payload) {
-  static const size_t MAX_VALUES = 128;
-  
-  // Only check max number of registers for standard function codes
-  if (number_of_entities > MAX_VALUES && function_code <= 0x10) {
-    ESP_LOGE(TAG, "send too many values %d max=%zu", number_of_entities, MAX_VALUES);
-    return;
-  }
-  
-  std::vector<uint8_t> data_send;
-  Transaction_Identifier++;
-  data_send.push_back(Transaction_Identifier >> 8);
-  data_send.push_back(Transaction_Identifier >> 0);
-  data_send.push_back(0x00);
-  data_send.push_back(0x00);
-  data_send.push_back(0x00);
-  if (payload != nullptr) { 
-    data_send.push_back(0x04 + payload_len);
-  } else {
-    data_send.push_back(0x06);
-  }
-  data_send.push_back(address);
-  data_send.push_back(function_code);
-  data_send.push_back(start_address >> 8);
-  data_send.push_back(start_address >> 0);
-  
-  if (function_code != 0x05 && function_code != 0x06) {
-    data_send.push_back(number_of_entities >> 8);
-    data_send.push_back(number_of_entities >> 0);
-  }
-
-  if (payload != nullptr) {
-    if (function_code == 0x0F || function_code == 0x17) {
-      data_send.push_back(payload_len);
-    } else {
-      payload_len = 2;
-    }
-    for (int i = 0; i < payload_len; i++) {
-      data_send.push_back(payload[i]);
-    }
-  }
-
+bool ModbusTCP::transmit_(const uint8_t *data, size_t len) {
   if (!network::is_connected()) {
-    return;
+    return false;
   }
   ensure_tcp_client();
 
-  if (client_ready_ && async_client_ != nullptr && async_client_->connected()) {
-    std::string res1;
-    char buf1[5];
-    for (size_t i = 12; i < data_send[5] + 6; i++) {
-      sprintf(buf1, "%02X", data_send[i]);
-      res1 += buf1;
-      res1 += ":";
-    }
-    
-    size_t written = async_client_->write(reinterpret_cast<const char*>(data_send.data()), data_send.size());
-    
-    if (written != data_send.size()) {
-      ESP_LOGW(TAG, "AsyncTCP write incomplete: %zu/%zu", written, data_send.size());
-      return;
-    }
-
-    ESP_LOGD(TAG, ">>> %02X%02X %02X%02X %02X%02X %02X %02X %02X%02X %02X%02X %s",
-                   data_send[0], data_send[1],  data_send[2], data_send[3], data_send[4], data_send[5],
-                   data_send[6], data_send[7],  data_send[8], data_send[9], data_send[10], data_send[11], res1.c_str());
-
-    waiting_for_response = address;
-    last_send_ = millis();
-  }
-}
-
-void ModbusTCP::send_raw(const std::vector<uint8_t> &payload) {
-  if (payload.empty()) {
-    return;
+  if (!client_ready_ || async_client_ == nullptr || !async_client_->connected()) {
+    return false;
   }
 
-  if (async_client_ != nullptr && async_client_->connected() && client_ready_) {
-    size_t written = async_client_->write(reinterpret_cast<const char*>(payload.data()), payload.size());
-    if (written != payload.size()) {
-      ESP_LOGW(TAG, "AsyncTCP send_raw incomplete: %zu/%zu", written, payload.size());
-      return;
-    }
-    
-    waiting_for_response = payload[0];
-    ESP_LOGV(TAG, "Modbus write raw: %s", format_hex_pretty(payload).c_str());
-    last_send_ = millis();
+  size_t written = async_client_->write(reinterpret_cast<const char *>(data), len);
+  if (written != len) {
+    ESP_LOGW(TAG, "AsyncTCP write incomplete: %zu/%zu", written, len);
+    return false;
   }
+  return true;
 }
 
 #else
 // ============================================================================
-// ESP-IDF lwip sockets Implementation
+// ESP-IDF lwip sockets / host POSIX sockets Implementation
 // ============================================================================
 
 void ModbusTCP::setup() {
   // Socket will be created in ensure_tcp_client when needed
   ESP_LOGCONFIG(TAG, "Setting up Modbus TCP client...");
+#ifdef MODBUSTCP_USE_EPOLL
+  this->epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (this->epoll_fd_ < 0) {
+    ESP_LOGE(TAG, "epoll_create1 failed: %d", errno);
+    this->mark_failed();
+  }
+#endif
 }
 
 void ModbusTCP::loop() {
-  const uint32_t now = App.get_loop_component_start_time();
-  
+  const uint32_t now = millis();
+
+  if (tcp_socket_ >= 0 && !connection_established_) {
+    this->check_connect_();
+  }
+
   // Check if socket is valid and connected
   if (tcp_socket_ < 0 || !connection_established_) {
+    this->check_timeouts_(now);
     return;
   }
-   
-  // Check if data is available using non-blocking recv
-  uint8_t byte1[256];
-  int available = recv(tcp_socket_, byte1, sizeof(byte1), MSG_DONTWAIT);
-  
-  if (available > 0) {
-    std::string res;
-    char buf[5];
-    size_t len = byte1[8];
-    for (size_t i = 9; i < len + 9 && i < sizeof(byte1); i++) {
-      sprintf(buf, "%02X", byte1[i]);
-      res += buf;
-      res += ":"; 
-    }
-    ESP_LOGD(TAG, "<<< %02X%02X %02X%02X %02X%02X %02X %02X %02X %s ",
-                        byte1[0], byte1[1], byte1[2], byte1[3], byte1[4], 
-                        byte1[5], byte1[6], byte1[7], byte1[8], res.c_str());
-
-    if ((byte1[7] & 0x80) == 0x80) {
-      ESP_LOGE(TAG,"Error:"); 
-      if (byte1[8]  == 0x01) {
-        ESP_LOGE(TAG,"Failure Code 0x01 ILLEGAL FUNCTION");
-      }
-      if (byte1[8]  == 0x02) {
-        ESP_LOGE(TAG,"Failure Code 0x02 ILLEGAL DATA ADDRESS");
-      }
-      if (byte1[8]  == 0x03) {
-        ESP_LOGE(TAG,"Failure Code 0x03 ILLEGAL DATA VALUE");
-      }
-      if (byte1[8]  == 0x04) {
-        ESP_LOGE(TAG,"Failure Code 0x04 SERVER FAILURE");
-      }
-      if (byte1[8]  == 0x05) {
-        ESP_LOGE(TAG,"Failure Code 0x05 ACKNOWLEDGE");
+
+  if (!this->socket_readable_(now)) {
+    this->idle_loops_++;
+    this->check_timeouts_(now);
+    return;
+  }
+
+  // Drain the socket with non-blocking recv until it is empty or the loop budget is used up,
+  // so several responses arriving between two loop iterations are all dispatched right away
+  const uint32_t start = micros();
+  uint8_t buffer[256];
+  while (true) {
+    int available = ::recv(tcp_socket_, buffer, sizeof(buffer), MSG_DONTWAIT);
+    this->recv_calls_++;
+
+    if (available > 0) {
+      this->process_received_(buffer, available);
+      if (static_cast<size_t>(available) < sizeof(buffer) || micros() - start >= this->loop_budget_us_) {
+        break;
       }
-      if (byte1[8]  == 0x06) {
-        ESP_LOGE(TAG,"Failure Code 0x06 SERVER BUSY");
+    } else if (available == 0) {
+      ESP_LOGW(TAG, "Connection closed by server");
+      this->close_connection_();
+      break;
+    } else {
+      // Check if it's a non-blocking "would block" error (normal) or a real error
+      if (errno != EWOULDBLOCK && errno != EAGAIN) {
+        ESP_LOGW(TAG, "Socket receive error: %d", errno);
+        this->close_connection_();
       }
-      return;
+      break;
     }
-  
-    uint8_t bytelen_len = 9;
-    std::vector<uint8_t> data(byte1 + bytelen_len, byte1 + bytelen_len + 9);
+  }
 
-    ESP_LOGV(TAG, "Incoming Data %02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X:%02X",
-                        data[0], data[1], data[2], data[3], data[4], 
-                        data[5], data[6], data[7], data[8]);
-    
+  this->check_timeouts_(now);
+}
 
-    for (auto *device : this->devices_) {
-      device->on_modbus_data(data);
-    }
-    if (now - this->last_send_ > send_wait_time_) {
-      if (waiting_for_response > 0) {
-        ESP_LOGD(TAG, "Stop waiting for response from %d", waiting_for_response);
-      }
-      waiting_for_response = 0;
-    }
-  } else if (available < 0) {
-    // Check if it's a non-blocking "would block" error (normal) or a real error
-    if (errno != EWOULDBLOCK && errno != EAGAIN) {
-      ESP_LOGW(TAG, "Socket receive error: %d", errno);
-      connection_established_ = false;
-      close(tcp_socket_);
-      tcp_socket_ = -1;
-    }
+// The main loop sleeps in select() on all registered sockets until one of them is readable or the loop interval
+// expires. Without that support the host asks its own epoll instance, lwip polls while responses are outstanding and
+// once per IDLE_RECV_INTERVAL otherwise, so a connection closed by the server is noticed while idle too.
+bool ModbusTCP::socket_readable_(uint32_t now) {
+#ifdef USE_SOCKET_SELECT_SUPPORT
+  if (this->socket_registered_) {
+    return App.is_socket_ready(tcp_socket_);
   }
+#endif
+#ifdef MODBUSTCP_USE_EPOLL
+  // level triggered - reports the socket as long as unread data (or the end of the stream) is pending
+  struct epoll_event event;
+  return epoll_wait(this->epoll_fd_, &event, 1, 0) > 0;
+#else
+  if (this->outstanding_ > 0 || now - this->last_idle_recv_ >= IDLE_RECV_INTERVAL) {
+    this->last_idle_recv_ = now;
+    return true;
+  }
+  return false;
+#endif
+}
+
+void ModbusTCP::check_connect_() {
+  fd_set write_fds;
+  FD_ZERO(&write_fds);
+  FD_SET(tcp_socket_, &write_fds);
+  struct timeval timeout = {};
+  int ready = select(tcp_socket_ + 1, nullptr, &write_fds, nullptr, &timeout);
+  if (ready == 0) {
+    // still connecting
+    return;
+  }
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+  if (ready < 0) {
+    error = errno;
+  } else if (getsockopt(tcp_socket_, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0) {
+    error = errno;
+  }
+  if (error != 0) {
+    ESP_LOGD(TAG, "client connect failed: %d", error);
+    this->close_connection_();
+    return;
+  }
+  ESP_LOGD(TAG, "client connected");
+  connection_established_ = true;
+  client_ready_ = true;
+}
+
+void ModbusTCP::close_connection_() {
+  connection_established_ = false;
+  client_ready_ = false;
+#ifdef MODBUSTCP_USE_EPOLL
+  if (!this->socket_registered_) {
+    epoll_ctl(this->epoll_fd_, EPOLL_CTL_DEL, tcp_socket_, nullptr);
+  }
+#endif
+#ifdef USE_SOCKET_SELECT_SUPPORT
+  if (this->socket_registered_) {
+    App.unregister_socket_fd(tcp_socket_);
+    this->socket_registered_ = false;
+  }
+#endif
+  close(tcp_socket_);
+  tcp_socket_ = -1;
+  this->rx_parser_.reset();
 }
 
 void ModbusTCP::ensure_tcp_client() {
@@ -352,6 +313,10 @@ void ModbusTCP::ensure_tcp_client() {
     return;
   }
   
+  if (tcp_socket_ >= 0 && !connection_established_) {
+    this->check_connect_();
+  }
+
   // Check if socket is connected
   if (tcp_socket_ >= 0 && connection_established_) {
     if (client_ready_ == false) {
@@ -404,6 +369,18 @@ void ModbusTCP::ensure_tcp_client() {
     }
     
     ESP_LOGD(TAG, "client connecting...");
+#ifdef USE_SOCKET_SELECT_SUPPORT
+    // wake the main loop as soon as a response arrives
+    this->socket_registered_ = App.register_socket_fd(tcp_socket_);
+#endif
+#ifdef MODBUSTCP_USE_EPOLL
+    if (!this->socket_registered_) {
+      struct epoll_event event = {};
+      event.events = EPOLLIN | EPOLLRDHUP;
+      event.data.fd = tcp_socket_;
+      epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, tcp_socket_, &event);
+    }
+#endif
     connection_established_ = (connect_result == 0);
     if (connection_established_) {
       client_ready_ = true;
@@ -412,126 +389,385 @@ void ModbusTCP::ensure_tcp_client() {
 }
 
 
-void ModbusTCP::send(uint8_t address, uint8_t function_code, uint16_t start_address, uint16_t number_of_entities, uint8_t payload_len, const uint8_t *payload) {
-  static const size_t MAX_VALUES = 128;
-  const uint32_t now = App.get_loop_component_start_time();
-  // Only check max number of registers for standard function codes
-  // Some devices use non standard codes like 0x43
-  if (number_of_entities > MAX_VALUES && function_code <= 0x10) {
-    ESP_LOGE(TAG, "send too many values %d max=%zu", number_of_entities, MAX_VALUES);
-    return;
+bool ModbusTCP::transmit_(const uint8_t *data, size_t len) {
+  if (!network::is_connected()) {
+    // ESP_LOGD(TAG, "network not ready");
+    return false;
   }
-  
-  std::vector<uint8_t> data_send;
-  Transaction_Identifier++;
-  data_send.push_back(Transaction_Identifier >> 8);
-  data_send.push_back(Transaction_Identifier >> 0);
-  data_send.push_back(0x00);
-  data_send.push_back(0x00);
-  data_send.push_back(0x00);
-  if (payload != nullptr) { 
-    data_send.push_back(0x04 + payload_len);
-  }else {
-    data_send.push_back(0x06);      // how many bytes next comes
-  }
-  data_send.push_back(address);
-  data_send.push_back(function_code);
-  data_send.push_back(start_address >> 8);
-  data_send.push_back(start_address >> 0);
-  // function nicht 5 oder nicht 6
-  if (function_code != 0x05 && function_code != 0x06) {
-    data_send.push_back(number_of_entities >> 8);
-    data_send.push_back(number_of_entities >> 0);
+  ensure_tcp_client();
+
+  if (!client_ready_ || tcp_socket_ < 0) {
+    return false;
   }
-  
 
-  if (payload != nullptr) {
-    if (function_code == 0x0F || function_code == 0x17) {  // Write multiple
-      data_send.push_back(payload_len);                    // Byte count is required for write
-    } else {
-      payload_len = 2;  // Write single register or coil
+  // Send using ESP-IDF socket
+#ifdef MODBUSTCP_USE_EPOLL
+  // don't raise SIGPIPE if the server closed the connection
+  int sent = ::send(tcp_socket_, reinterpret_cast<const char *>(data), len, MSG_NOSIGNAL);
+#else
+  int sent = ::send(tcp_socket_, reinterpret_cast<const char *>(data), len, 0);
+#endif
+  if (sent < 0) {
+    ESP_LOGW(TAG, "send failed: %d", errno);
+    this->close_connection_();
+    return false;
+  }
+  return true;
+}
+
+#endif  // MODBUSTCP_USE_ASYNC
+
+// ============================================================================
+// Common Implementation (used by both Arduino and ESP-IDF)
+// ============================================================================
+
+// Feed a received chunk into the frame reassembler and dispatch every complete response.
+// A chunk can contain a partial frame or several frames back to back.
+void ModbusTCP::process_received_(const uint8_t *data, size_t len) {
+  while (len > 0) {
+    size_t accepted = this->rx_parser_.feed(data, len);
+    data += accepted;
+    len -= accepted;
+
+    MBAPFrame frame;
+    while (this->rx_parser_.next_frame(frame)) {
+      this->on_frame_(frame);
+      this->rx_parser_.consume();
     }
-    for (int i = 0; i < payload_len; i++) {
-      data_send.push_back(payload[i]);
+
+    if (accepted == 0) {
+      // can't happen as long as the buffer is larger than a frame - but never spin here
+      ESP_LOGW(TAG, "Receive buffer overflow - dropping %zu bytes", this->rx_parser_.available());
+      this->rx_parser_.reset();
     }
   }
+}
 
-  if (!network::is_connected()) {
-    // ESP_LOGD(TAG, "network not ready");
+void ModbusTCP::on_frame_(const MBAPFrame &frame) {
+  this->trace_frame_("<<<", frame.adu, frame.adu_len);
+
+  if (frame.pdu_len < 2) {
+    // keep the transaction open, check_timeouts_() reports it to the device which can retry
+    ESP_LOGW(TAG, "Response too short: %u bytes", frame.pdu_len);
     return;
   }
-  ensure_tcp_client();
 
-  if (client_ready_ && tcp_socket_ >= 0) {
-      
-    std::string res1;
-    char buf1[5];
-    size_t len1 = 11; 
-    for (size_t i = 12; i < data_send[5] + 6; i++) {
-      sprintf(buf1, "%02X", data_send[i]);
-      res1 += buf1;
-      res1 += ":";
+  ModbusDevice *device = this->release_transaction_(frame);
+  if (device == nullptr) {
+    // late response for a transaction that timed out already or a frame nobody asked for
+    this->unmatched_frames_++;
+    ESP_LOGW(TAG, "Dropping response with unknown transaction %u unit %u (%u dropped)", frame.transaction_id,
+             frame.unit_id, this->unmatched_frames_);
+    return;
+  }
+  device->responses_received_++;
+
+  uint8_t function_code = frame.function_code();
+  // Check for Modbus error response
+  if ((function_code & FUNCTION_CODE_EXCEPTION_MASK) == FUNCTION_CODE_EXCEPTION_MASK) {
+    ESP_LOGE(TAG, "Error:");
+    if (frame.pdu[1] == 0x01) {
+      ESP_LOGE(TAG, "Failure Code 0x01 ILLEGAL FUNCTION");
     }
-    
-    // Send using ESP-IDF socket
-    int sent = send(tcp_socket_, reinterpret_cast<const char*>(data_send.data()), data_send.size(), 0);
-    
-    if (sent < 0) {
-      ESP_LOGW(TAG, "send failed: %d", errno);
-      connection_established_ = false;
-      close(tcp_socket_);
-      tcp_socket_ = -1;
-      return;
+    if (frame.pdu[1] == 0x02) {
+      ESP_LOGE(TAG, "Failure Code 0x02 ILLEGAL DATA ADDRESS");
+    }
+    if (frame.pdu[1] == 0x03) {
+      ESP_LOGE(TAG, "Failure Code 0x03 ILLEGAL DATA VALUE");
+    }
+    if (frame.pdu[1] == 0x04) {
+      ESP_LOGE(TAG, "Failure Code 0x04 SERVER FAILURE");
+    }
+    if (frame.pdu[1] == 0x05) {
+      ESP_LOGE(TAG, "Failure Code 0x05 ACKNOWLEDGE");
     }
+    if (frame.pdu[1] == 0x06) {
+      ESP_LOGE(TAG, "Failure Code 0x06 SERVER BUSY");
+    }
+    device->on_modbus_error(frame.transaction_id, function_code & FUNCTION_CODE_MASK, frame.pdu[1]);
+    return;
+  }
 
-    ESP_LOGD(TAG, ">>> %02X%02X %02X%02X %02X%02X %02X %02X %02X%02X %02X%02X %s",
-                   data_send[0], data_send[1],  data_send[2], data_send[3], data_send[4], data_send[5],
-                   data_send[6], data_send[7],  data_send[8], data_send[9], data_send[10], data_send[11], res1.c_str());
+  const uint8_t *data_begin;
+  const uint8_t *data_end = frame.pdu + frame.pdu_len;
+  switch (function_code) {
+    case 0x05:  // Write single coil
+    case 0x06:  // Write single register
+    case 0x0F:  // Write multiple coils
+    case 0x10:  // Write multiple registers
+    case 0x16:  // Mask write register
+      // the response echoes address and value/quantity
+      data_begin = frame.pdu + 1;
+      break;
+    default:
+      // read responses start with the byte count
+      data_begin = frame.pdu + 2;
+      data_end = std::min(data_end, data_begin + frame.pdu[1]);
+      break;
+  }
+  // assign() reuses the capacity of the receive vector so no allocation happens in the steady state
+  this->rx_data_.assign(data_begin, data_end);
+
+  device->on_modbus_data(frame.transaction_id, this->rx_data_);
+}
+
+uint16_t ModbusTCP::send(uint8_t address, uint8_t function_code, uint16_t start_address, uint16_t number_of_entities,
+                         uint8_t payload_len, const uint8_t *payload, ModbusDevice *device) {
+  // Only check max number of registers for standard function codes
+  // Some devices use non standard codes like 0x43
+  uint16_t max_quantity = max_quantity_for_function(function_code);
+  if (max_quantity > 0 && number_of_entities > max_quantity) {
+    ESP_LOGE(TAG, "send too many values %d max=%u", number_of_entities, max_quantity);
+    return 0;
+  }
+  if (function_code == 0x17 && payload_len >= 4) {
+    // write address and write quantity precede the values
+    uint16_t write_quantity = uint16_t(payload[2]) << 8 | payload[3];
+    if (write_quantity > MAX_NUM_OF_REGISTERS_TO_READ_WRITE) {
+      ESP_LOGE(TAG, "send too many values to write %u max=%u", write_quantity, MAX_NUM_OF_REGISTERS_TO_READ_WRITE);
+      return 0;
+    }
+  }
+  if (!this->can_send()) {
+    ESP_LOGW(TAG, "send rejected - %u transactions outstanding", this->outstanding_);
+    return 0;
+  }
 
-    waiting_for_response = address;
-    last_send_ = esp_timer_get_time() / 1000;  // Convert microseconds to milliseconds
+  uint16_t transaction_id = this->next_transaction_id_();
+  // serialize into the preallocated frame buffer - no heap allocation per request
+  size_t len = encode_request(this->tx_buffer_, sizeof(this->tx_buffer_), transaction_id, address, function_code,
+                              start_address, number_of_entities, payload_len, payload);
+  if (len == 0) {
+    ESP_LOGE(TAG, "request for function 0x%02X too large", function_code);
+    return 0;
+  }
+  if (!this->transmit_(this->tx_buffer_, len)) {
+    return 0;
   }
+  this->trace_frame_(">>>", this->tx_buffer_, len);
+
+  this->track_transaction_(transaction_id, address, device);
+  return transaction_id;
 }
 
 // Helper function for lambdas
-// Send raw command. Except CRC everything must be contained in payload
+// Send raw command. Except CRC everything must be contained in payload.
+// The payload starts with the unit id like a Modbus RTU frame, the MBAP header is added here.
+uint16_t ModbusTCP::send_raw(const std::vector<uint8_t> &payload, ModbusDevice *device) {
+  if (payload.empty() || payload.size() > MBAP_MAX_LENGTH) {
+    return 0;
+  }
+  if (!this->can_send()) {
+    ESP_LOGW(TAG, "send_raw rejected - %u transactions outstanding", this->outstanding_);
+    return 0;
+  }
 
-void ModbusTCP::send_raw(const std::vector<uint8_t> &payload) {
-  if (payload.empty()) {
-    return;
+  uint16_t transaction_id = this->next_transaction_id_();
+  size_t len = encode_raw(this->tx_buffer_, sizeof(this->tx_buffer_), transaction_id, payload.data(), payload.size());
+  if (!this->transmit_(this->tx_buffer_, len)) {
+    return 0;
   }
 
-  if (tcp_socket_ >= 0 && client_ready_) {
-    int sent = send(tcp_socket_, reinterpret_cast<const char*>(payload.data()), payload.size(), 0);
-    if (sent < 0) {
-      ESP_LOGW(TAG, "send_raw failed: %d", errno);
-      connection_established_ = false;
-      close(tcp_socket_);
-      tcp_socket_ = -1;
-      return;
+  this->trace_frame_(">>>", this->tx_buffer_, len);
+  this->track_transaction_(transaction_id, payload[0], device);
+  return transaction_id;
+}
+
+bool ModbusTCP::send_response(uint16_t transaction_id, const std::vector<uint8_t> &payload) {
+  if (payload.empty() || payload.size() > MBAP_MAX_LENGTH) {
+    return false;
+  }
+
+  // responses are never answered, so they neither wait for a free slot nor occupy one. The client matches them by
+  // the transaction id of its request
+  size_t len = encode_raw(this->tx_buffer_, sizeof(this->tx_buffer_), transaction_id, payload.data(), payload.size());
+  if (!this->transmit_(this->tx_buffer_, len)) {
+    return false;
+  }
+
+  this->trace_frame_(">>>", this->tx_buffer_, len);
+  return true;
+}
+
+uint16_t ModbusTCP::send_frame(uint8_t *frame, size_t len, ModbusDevice *device) {
+  if (len < MBAP_HEADER_SIZE + 1) {
+    return 0;
+  }
+  if (!this->can_send()) {
+    ESP_LOGW(TAG, "send_frame rejected - %u transactions outstanding", this->outstanding_);
+    return 0;
+  }
+
+  uint16_t transaction_id = this->next_transaction_id_();
+  set_transaction_id(frame, transaction_id);
+  if (!this->transmit_(frame, len)) {
+    return 0;
+  }
+
+  this->trace_frame_(">>>", frame, len);
+  this->track_transaction_(transaction_id, frame[MBAP_HEADER_SIZE - 1], device);
+  return transaction_id;
+}
+
+void ModbusTCP::register_device(ModbusDevice *device) {
+  // responses are routed to the device that sent the request, the unit id only picks the device answering server
+  // mode requests and requests sent without a device
+  if (this->device_index_[device->address_] == NO_DEVICE) {
+    this->device_index_[device->address_] = this->devices_.size();
+  }
+  this->devices_.push_back(device);
+  this->deficits_.push_back(0);
+}
+
+/*
+  All devices on the connection share the window of outstanding transactions. Instead of letting each device send
+  from its own loop() (the first one in component order wins), the transport fills the window with deficit
+  round-robin: a device with waiting requests gets send_weight requests per turn, then the next device follows.
+  A device without requests loses the rest of its turn, so idle devices can't build up credit.
+*/
+void ModbusTCP::send_pending() {
+  size_t idle = 0;
+  while (this->can_send() && idle < this->devices_.size()) {
+    ModbusDevice *device = this->devices_[this->next_device_];
+    uint8_t &deficit = this->deficits_[this->next_device_];
+    bool sent = false;
+    if (device->has_pending_request()) {
+      if (deficit == 0) {
+        deficit = device->get_send_weight();
+      }
+      sent = device->send_pending_request();
     }
-    
-    waiting_for_response = payload[0];
-    ESP_LOGV(TAG, "Modbus write raw: %s", format_hex_pretty(payload).c_str());
-    last_send_ = esp_timer_get_time() / 1000;  // Convert microseconds to milliseconds
+    if (sent) {
+      idle = 0;
+      if (--deficit > 0) {
+        continue;
+      }
+    } else {
+      deficit = 0;
+      idle++;
+    }
+    this->next_device_ = (this->next_device_ + 1) % this->devices_.size();
   }
 }
 
-#endif  // MODBUSTCP_USE_ASYNC
+ModbusDevice *ModbusTCP::device_for_unit_(uint8_t unit_id) const {
+  uint8_t index = this->device_index_[unit_id];
+  return index == NO_DEVICE ? nullptr : this->devices_[index];
+}
 
-// ============================================================================
-// Common Implementation (used by both Arduino and ESP-IDF)
-// ============================================================================
+uint16_t ModbusTCP::next_transaction_id_() {
+  // The pending table is indexed by the low bits of the transaction id. Skip ids whose slot is still taken by an
+  // older request, there is always a free one because outstanding_ < MAX_OUTSTANDING_TRANSACTIONS.
+  // 0 is never used so it can mark a request that wasn't sent
+  do {
+    if (++this->transaction_identifier_ == 0) {
+      this->transaction_identifier_ = 1;
+    }
+  } while (this->pending_slot_(this->transaction_identifier_).transaction_id != 0);
+  return this->transaction_identifier_;
+}
+
+void ModbusTCP::track_transaction_(uint16_t transaction_id, uint8_t address, ModbusDevice *device) {
+  auto &pending = this->pending_slot_(transaction_id);
+  pending.transaction_id = transaction_id;
+  pending.address = address;
+  pending.device = device != nullptr ? device : this->device_for_unit_(address);
+  pending.sent_at = millis();
+  this->outstanding_++;
+  if (pending.device != nullptr) {
+    pending.device->requests_sent_++;
+  }
+}
+
+ModbusDevice *ModbusTCP::release_transaction_(const MBAPFrame &frame) {
+  auto &pending = this->pending_slot_(frame.transaction_id);
+  if (pending.transaction_id != frame.transaction_id || pending.address != frame.unit_id) {
+    return nullptr;
+  }
+  pending.transaction_id = 0;
+  this->outstanding_--;
+  return pending.device;
+}
+
+void ModbusTCP::check_timeouts_(uint32_t now) {
+  if (this->outstanding_ == 0) {
+    return;
+  }
+  for (auto &pending : this->pending_) {
+    if (pending.transaction_id != 0 && now - pending.sent_at > this->send_wait_time_) {
+      uint16_t transaction_id = pending.transaction_id;
+      ESP_LOGD(TAG, "Stop waiting for response from %d transaction %u", pending.address, transaction_id);
+      pending.transaction_id = 0;
+      this->outstanding_--;
+      if (pending.device != nullptr) {
+        pending.device->timeouts_++;
+        pending.device->on_modbus_timeout(transaction_id);
+      }
+    }
+  }
+}
+
+// Log a frame as hex dump: "TTTT PPPP LLLL UU FF:DD:DD..." (MBAP header fields, then the PDU).
+// Compiled in only with VERBOSE logging and formatted into a stack buffer only if the logger emits it.
+void ModbusTCP::trace_frame_(const char *direction, const uint8_t *frame, size_t len) {
+#if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE
+#ifdef USE_LOGGER
+  if (logger::global_logger == nullptr || logger::global_logger->level_for(TAG) < ESPHOME_LOG_LEVEL_VERBOSE) {
+    return;
+  }
+#endif
+  static const char HEX_DIGITS[] = "0123456789ABCDEF";
+  static const size_t MAX_TRACE_BYTES = 64;
+  if (len < MBAP_HEADER_SIZE) {
+    return;
+  }
+  char buf[3 * MAX_TRACE_BYTES + 4];
+  char *pos = buf;
+  for (size_t i = MBAP_HEADER_SIZE - 1; i < len && i < MAX_TRACE_BYTES; i++) {
+    *pos++ = HEX_DIGITS[frame[i] >> 4];
+    *pos++ = HEX_DIGITS[frame[i] & 0x0F];
+    *pos++ = i == MBAP_HEADER_SIZE - 1 ? ' ' : ':';
+  }
+  if (len > MAX_TRACE_BYTES) {
+    *pos++ = '.';
+    *pos++ = '.';
+    *pos++ = '.';
+  } else {
+    pos--;  // drop the trailing separator
+  }
+  *pos = '\0';
+  ESP_LOGV(TAG, "%s %02X%02X %02X%02X %02X%02X %s", direction, frame[0], frame[1], frame[2], frame[3], frame[4],
+           frame[5], buf);
+#endif
+}
 
 void ModbusTCP::dump_config() {
   ESP_LOGCONFIG(TAG, "Modbus_TCP:");
   ESP_LOGCONFIG(TAG, "  Client: %s:%d \n"
-                     "  Send Wait Time: %d ms\n",
-                         host_.c_str(), port_, this->send_wait_time_);
+                     "  Send Wait Time: %d ms\n"
+                     "  Loop Budget: %u us\n"
+                     "  Max Outstanding: %u\n"
+                     "  Dropped Responses: %u\n",
+                         host_.c_str(), port_, this->send_wait_time_, this->loop_budget_us_, this->max_outstanding_,
+                         this->unmatched_frames_);
 #ifdef MODBUSTCP_USE_ASYNC
   ESP_LOGCONFIG(TAG, "  Transport: AsyncTCP (Arduino framework)");
+#elif defined(MODBUSTCP_USE_EPOLL)
+  ESP_LOGCONFIG(TAG, "  Transport: POSIX sockets with epoll (host platform)");
 #else
   ESP_LOGCONFIG(TAG, "  Transport: lwip sockets (ESP-IDF framework)");
+#endif
+  for (auto *device : this->devices_) {
+    ESP_LOGCONFIG(TAG, "  Device %u: send weight %u", device->address_, device->get_send_weight());
+  }
+#ifndef MODBUSTCP_USE_ASYNC
+#ifdef USE_SOCKET_SELECT_SUPPORT
+  ESP_LOGCONFIG(TAG, "  Receive: main loop select() wakeup");
+#elif defined(MODBUSTCP_USE_EPOLL)
+  ESP_LOGCONFIG(TAG, "  Receive: epoll readiness, checked every loop");
+#else
+  ESP_LOGCONFIG(TAG, "  Receive: polling while responses are outstanding, every %u ms when idle", IDLE_RECV_INTERVAL);
+#endif
 #endif
 }
 
@@ -1,11 +1,18 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+#include "modbustcp_definitions.h"
+#include "modbustcp_frame.h"
+#include <algorithm>
+#include <array>
 #include <vector>
 
 // Conditional includes based on framework
 // Arduino framework: Use AsyncTCP for non-blocking async operations
 // ESP-IDF framework: Use lwip sockets for synchronous operations
+// Host platform: Use POSIX sockets with epoll readiness (off-device testing)
 #ifdef ARDUINO
   // Arduino framework - AsyncTCP support
   #ifdef ESP32
@@ -14,6 +21,14 @@
     #include <ESPAsyncTCP.h>
   #endif
   #define MODBUSTCP_USE_ASYNC
+#elif defined(USE_HOST)
+  // Linux host platform - POSIX sockets
+  #include <netdb.h>
+  #include <netinet/in.h>
+  #include <sys/epoll.h>
+  #include <sys/socket.h>
+  #include <unistd.h>
+  #define MODBUSTCP_USE_EPOLL
 #else
   // ESP-IDF framework - use lwip sockets
   #include "lwip/sockets.h"
@@ -24,14 +39,28 @@
 namespace esphome {
 namespace modbustcp {
 
+/// upper limit for the number of requests in flight on one connection (power of 2, used as table size)
+static const uint8_t MAX_OUTSTANDING_TRANSACTIONS = 16;
+/// marks a unit id without registered device in the dispatch table
+static const uint8_t NO_DEVICE = 0xFF;
 
 class ModbusDevice;
 
+/// A request that was sent and waits for its response
+struct PendingTransaction {
+  /// 0 marks a free slot
+  uint16_t transaction_id{0};
+  uint8_t address{0};
+  uint32_t sent_at{0};
+  /// the device the response is routed to
+  ModbusDevice *device{nullptr};
+};
+
 class ModbusTCP :  public Component {
 
  public:
  
-   ModbusTCP() = default;
+   ModbusTCP() { this->device_index_.fill(NO_DEVICE); }
 
   void setup() override;
 
@@ -39,15 +68,44 @@ class ModbusTCP :  public Component {
 
   void dump_config() override;
 
-  void register_device(ModbusDevice *device) { this->devices_.push_back(device); }
+  void register_device(ModbusDevice *device);
+  /// number of devices sharing this connection and the position of one of them, to spread their polls
+  size_t get_device_count() const { return this->devices_.size(); }
+  size_t get_device_position(const ModbusDevice *device) const {
+    return std::find(this->devices_.begin(), this->devices_.end(), device) - this->devices_.begin();
+  }
 
   float get_setup_priority() const override;
 
-  void send(uint8_t address, uint8_t function_code, uint16_t start_address, uint16_t number_of_entities,
-            uint8_t payload_len = 0, const uint8_t *payload = nullptr);
-  void send_raw(const std::vector<uint8_t> &payload);
-  uint8_t waiting_for_response{0};
+  /// fill the window of outstanding transactions from the queues of the devices, deficit round-robin
+  void send_pending();
+  /// send a request. Returns the transaction id or 0 if the request could not be sent.
+  /// The response goes to device, or to the first device registered for the unit id if it is nullptr
+  uint16_t send(uint8_t address, uint8_t function_code, uint16_t start_address, uint16_t number_of_entities,
+                uint8_t payload_len = 0, const uint8_t *payload = nullptr, ModbusDevice *device = nullptr);
+  /// send unit id and PDU wrapped in a MBAP header. Returns the transaction id or 0 if the request could not be sent
+  uint16_t send_raw(const std::vector<uint8_t> &payload, ModbusDevice *device = nullptr);
+  /// send a response in server mode: unit id and PDU wrapped in a MBAP header with the transaction id of the
+  /// request. No transaction is tracked, the response doesn't wait for an answer and doesn't take a place in the
+  /// window of outstanding transactions
+  bool send_response(uint16_t transaction_id, const std::vector<uint8_t> &payload);
+  /// send a prebuilt frame (see encode_request). Only the transaction id is patched in.
+  /// Returns the transaction id or 0 if the request could not be sent
+  uint16_t send_frame(uint8_t *frame, size_t len, ModbusDevice *device = nullptr);
+  /// true if another request fits into the window of outstanding transactions
+  bool can_send() const { return this->outstanding_ < this->max_outstanding_; }
+  uint8_t get_outstanding() const { return this->outstanding_; }
+  /// number of responses dropped because they matched no outstanding transaction
+  uint32_t get_unmatched_frames() const { return this->unmatched_frames_; }
+  /// number of recv() calls and of loop iterations that found nothing to read, to measure the idle loop cost
+  uint32_t get_recv_calls() const { return this->recv_calls_; }
+  uint32_t get_idle_loops() const { return this->idle_loops_; }
   void set_send_wait_time(uint16_t time_in_ms) { send_wait_time_ = time_in_ms; }
+  /// max time in µs loop() spends reading and dispatching responses per iteration
+  void set_loop_budget(uint32_t loop_budget_us) { this->loop_budget_us_ = loop_budget_us; }
+  void set_max_outstanding(uint8_t max_outstanding) {
+    this->max_outstanding_ = std::min<uint8_t>(std::max<uint8_t>(max_outstanding, 1), MAX_OUTSTANDING_TRANSACTIONS);
+  }
   void set_host(const std::string &host) { this->host_ = host; }
   void set_port(uint16_t port) { this->port_ = port; }
   
@@ -66,46 +124,139 @@ class ModbusTCP :  public Component {
   void on_async_disconnect_(void *arg, AsyncClient *client);
   void on_async_error_(void *arg, AsyncClient *client, int8_t error);
   void on_async_data_(void *arg, AsyncClient *client, void *data, size_t len);
+  /// hand the bytes received on the AsyncTCP task to process_received_(). Runs in loop()
+  void process_async_received_();
+  /* The AsyncTCP callbacks run on the AsyncTCP task. They only copy the received bytes into async_rx_buffer_,
+   * responses are parsed and dispatched in loop() so the transaction table and the devices are only touched from
+   * the main loop. */
+  Mutex async_rx_lock_;
+  uint8_t async_rx_buffer_[MBAPFrameParser::CAPACITY];
+  size_t async_rx_len_{0};
+  /// bytes dropped because loop() didn't pick up async_rx_buffer_ in time
+  size_t async_rx_dropped_{0};
+  /// the connection changed - drop partially received frames in the next loop()
+  bool async_rx_reset_{false};
+  /// async_rx_buffer_ is copied here so the lock isn't held while the responses are dispatched
+  uint8_t async_rx_work_[MBAPFrameParser::CAPACITY];
 #else
-  // ESP-IDF socket descriptor
+  // ESP-IDF / host socket descriptor
   int tcp_socket_{-1};
+#ifdef MODBUSTCP_USE_EPOLL
+  /// epoll instance watching tcp_socket_
+  int epoll_fd_{-1};
+#endif
   bool connection_established_{false};
+  /// true if the socket is part of the main loop select() and wakes the loop when data arrives
+  bool socket_registered_{false};
+  void close_connection_();
+  /// complete a non-blocking connect once the socket becomes writable
+  void check_connect_();
+  /// true if recv() has something to return
+  bool socket_readable_(uint32_t now);
+#ifndef MODBUSTCP_USE_EPOLL
+  /// last poll of the socket, see socket_readable_()
+  uint32_t last_idle_recv_{0};
 #endif
+#endif
+
+  /// write a complete ADU to the connection
+  bool transmit_(const uint8_t *data, size_t len);
+  uint16_t next_transaction_id_();
+  /// remember a sent request until its response arrives or it times out. The response goes to device
+  void track_transaction_(uint16_t transaction_id, uint8_t address, ModbusDevice *device);
+  /// close the transaction of a response. Returns the device waiting for it or nullptr if nobody is
+  ModbusDevice *release_transaction_(const MBAPFrame &frame);
+  PendingTransaction &pending_slot_(uint16_t transaction_id) {
+    return this->pending_[transaction_id & (MAX_OUTSTANDING_TRANSACTIONS - 1)];
+  }
+  ModbusDevice *device_for_unit_(uint8_t unit_id) const;
+  /// drop transactions without response after send_wait_time and notify the devices
+  void check_timeouts_(uint32_t now);
+
+  /// feed received bytes into the frame reassembler and dispatch complete responses
+  void process_received_(const uint8_t *data, size_t len);
+  /// handle one complete response frame
+  void on_frame_(const MBAPFrame &frame);
+  /// hex dump of a frame at VERBOSE log level
+  void trace_frame_(const char *direction, const uint8_t *frame, size_t len);
+  /// requests are serialized here before they are written to the connection
+  uint8_t tx_buffer_[MBAP_MAX_ADU_SIZE];
+  /// reassembles responses from the TCP byte stream
+  MBAPFrameParser rx_parser_;
+  /// response data handed to the devices. Reused to avoid an allocation per response
+  std::vector<uint8_t> rx_data_;
   
   //bool parse_modbus_byte_(uint8_t byte);
   uint16_t send_wait_time_{250};
+  uint32_t loop_budget_us_{2000};
   uint32_t last_modbus_byte_{0};
-  uint32_t last_send_{0};
   std::vector<ModbusDevice *> devices_;
-  uint16_t Transaction_Identifier = 0;
+  /// requests each device may still send in its current round-robin turn
+  std::vector<uint8_t> deficits_;
+  /// the device whose turn it is
+  size_t next_device_{0};
+  uint16_t transaction_identifier_{0};
+  /// requests in flight, indexed by the low bits of the transaction id
+  std::array<PendingTransaction, MAX_OUTSTANDING_TRANSACTIONS> pending_{};
+  /// index into devices_ for each unit id: the first device registered for it answers server mode requests and gets
+  /// the responses to requests sent without a device
+  std::array<uint8_t, 256> device_index_;
+  uint32_t unmatched_frames_{0};
+  uint32_t recv_calls_{0};
+  uint32_t idle_loops_{0};
+  uint8_t outstanding_{0};
+  uint8_t max_outstanding_{1};
   uint16_t port_;
   std::string host_;
    
 };
 
+/// A device behind the connection. ModbusTCP delivers responses, errors and timeouts to the device that sent the
+/// request, always from ModbusTCP::loop() - also with AsyncTCP - so the callbacks may use the device state freely.
 class ModbusDevice {
  public:
   void set_parent(ModbusTCP *parent) { parent_ = parent; }
   void set_address(uint8_t address) { address_ = address; }
-  virtual void on_modbus_data(const std::vector<uint8_t> &data) = 0;
-  virtual void on_modbus_error(uint8_t function_code, uint8_t exception_code) {}
-  virtual void on_modbus_read_registers(uint8_t function_code, uint16_t start_address, uint16_t number_of_registers){};
-  virtual void on_modbus_write_registers(uint8_t function_code, const std::vector<uint8_t> &data){};
-  void send(uint8_t function, uint16_t start_address, uint16_t number_of_entities, uint8_t payload_len = 0,
-            const uint8_t *payload = nullptr) {
-    this->parent_->send(this->address_, function, start_address, number_of_entities, payload_len, payload);
+  virtual void on_modbus_data(uint16_t transaction_id, const std::vector<uint8_t> &data) = 0;
+  virtual void on_modbus_error(uint16_t transaction_id, uint8_t function_code, uint8_t exception_code) {}
+  /// called when no response was received for a transaction within send_wait_time
+  virtual void on_modbus_timeout(uint16_t transaction_id) {}
+  virtual void on_modbus_read_registers(uint16_t transaction_id, uint8_t function_code, uint16_t start_address,
+                                        uint16_t number_of_registers){};
+  virtual void on_modbus_write_registers(uint16_t transaction_id, uint8_t function_code,
+                                         const std::vector<uint8_t> &data){};
+  /// true if a request is ready to be sent by ModbusTCP::send_pending()
+  virtual bool has_pending_request() { return false; }
+  /// send the next queued request. Returns false if nothing was sent
+  virtual bool send_pending_request() { return false; }
+  /// requests sent per round-robin turn when several devices have requests waiting
+  void set_send_weight(uint8_t send_weight) { this->send_weight_ = std::max<uint8_t>(send_weight, 1); }
+  uint8_t get_send_weight() const { return this->send_weight_; }
+  /// throughput counters maintained by ModbusTCP
+  uint32_t get_requests_sent() const { return this->requests_sent_; }
+  uint32_t get_responses_received() const { return this->responses_received_; }
+  uint32_t get_timeouts() const { return this->timeouts_; }
+  uint16_t send(uint8_t function, uint16_t start_address, uint16_t number_of_entities, uint8_t payload_len = 0,
+                const uint8_t *payload = nullptr) {
+    return this->parent_->send(this->address_, function, start_address, number_of_entities, payload_len, payload,
+                               this);
+  }
+  uint16_t send_raw(const std::vector<uint8_t> &payload) { return this->parent_->send_raw(payload, this); }
+  uint16_t send_frame(uint8_t *frame, size_t len) { return this->parent_->send_frame(frame, len, this); }
+  /// answer a request in server mode, transaction_id is the one of the request
+  bool send_response(uint16_t transaction_id, const std::vector<uint8_t> &payload) {
+    return this->parent_->send_response(transaction_id, payload);
   }
-  void send_raw(const std::vector<uint8_t> &payload) { this->parent_->send_raw(payload); }
-  void send_error(uint8_t function_code, uint8_t exception_code) {
+  void send_error(uint16_t transaction_id, uint8_t function_code, uint8_t exception_code) {
     std::vector<uint8_t> error_response;
     error_response.reserve(3);
     error_response.push_back(this->address_);
     error_response.push_back(function_code | 0x80);
     error_response.push_back(exception_code);
-    this->send_raw(error_response);
+    this->send_response(transaction_id, error_response);
   }
-  // If more than one device is connected block sending a new command before a response is received
-  bool waiting_for_response() { return parent_->waiting_for_response != 0; }
+  // Block sending a new command while the window of outstanding transactions is full
+  bool waiting_for_response() { return !parent_->can_send(); }
 
     
 
@@ -114,6 +265,10 @@ class ModbusDevice {
   
   ModbusTCP *parent_;
   uint8_t address_;
+  uint8_t send_weight_{1};
+  uint32_t requests_sent_{0};
+  uint32_t responses_received_{0};
+  uint32_t timeouts_{0};
 };
 
 }  // namespace modbustcp
@@ -31,8 +31,8 @@ enum class ModbusFunctionCode : uint8_t {
   REPORT_SERVER_ID = 0x11,               // not implemented
   READ_FILE_RECORD = 0x14,               // not implemented
   WRITE_FILE_RECORD = 0x15,              // not implemented
-  MASK_WRITE_REGISTER = 0x16,            // not implemented
-  READ_WRITE_MULTIPLE_REGISTERS = 0x17,  // not implemented
+  MASK_WRITE_REGISTER = 0x16,
+  READ_WRITE_MULTIPLE_REGISTERS = 0x17,
   READ_FIFO_QUEUE = 0x18,                // not implemented
 };
 
@@ -78,9 +78,40 @@ enum class ModbusExceptionCode : uint8_t {
 // 6.12 16 (0x10) Write Multiple registers:
 const uint8_t MAX_NUM_OF_REGISTERS_TO_WRITE = 123;  // 0x7B
 
+// 6.17 23 (0x17) Read/Write Multiple registers
+const uint8_t MAX_NUM_OF_REGISTERS_TO_READ_WRITE = 121;  // 0x79
+
 // 6.3 03 (0x03) Read Holding Registers
 // 6.4 04 (0x04) Read Input Registers
 const uint8_t MAX_NUM_OF_REGISTERS_TO_READ = 125;  // 0x7D
+
+// 6.1 01 (0x01) Read Coils
+// 6.2 02 (0x02) Read Discrete Inputs
+const uint16_t MAX_NUM_OF_COILS_TO_READ = 2000;  // 0x7D0
+
+// 6.11 15 (0x0F) Write Multiple Coils
+const uint16_t MAX_NUM_OF_COILS_TO_WRITE = 1968;  // 0x7B0
+
+/// Max quantity of coils or registers a request with this function code may address. 0 if the spec has no limit
+inline uint16_t max_quantity_for_function(uint8_t function_code) {
+  switch (function_code) {
+    case 0x01:
+    case 0x02:
+      return MAX_NUM_OF_COILS_TO_READ;
+    case 0x03:
+    case 0x04:
+      return MAX_NUM_OF_REGISTERS_TO_READ;
+    case 0x0F:
+      return MAX_NUM_OF_COILS_TO_WRITE;
+    case 0x10:
+      return MAX_NUM_OF_REGISTERS_TO_WRITE;
+    case 0x17:
+      // the read quantity, the write quantity in the payload is limited to MAX_NUM_OF_REGISTERS_TO_READ_WRITE
+      return MAX_NUM_OF_REGISTERS_TO_READ;
+    default:
+      return 0;
+  }
+}
 /// End of Modbus definitions
 }  // namespace modbustcp
 }  // namespace esphome
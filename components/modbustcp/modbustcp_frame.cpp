@@ -0,0 +1,134 @@
+#include "modbustcp_frame.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace modbustcp {
+
+static void put_mbap_header(uint8_t *buffer, uint16_t transaction_id, uint16_t length) {
+  set_transaction_id(buffer, transaction_id);
+  buffer[2] = 0x00;  // protocol id
+  buffer[3] = 0x00;
+  buffer[4] = length >> 8;
+  buffer[5] = length >> 0;
+}
+
+size_t encode_request(uint8_t *buffer, size_t size, uint16_t transaction_id, uint8_t unit_id, uint8_t function_code,
+                      uint16_t start_address, uint16_t number_of_entities, uint8_t payload_len,
+                      const uint8_t *payload) {
+  bool single_write = function_code == 0x05 || function_code == 0x06;
+  bool multiple_write = function_code == 0x0F || function_code == 0x10;
+  bool mask_write = function_code == 0x16;
+  if (payload == nullptr) {
+    payload_len = 0;
+  } else if (single_write) {
+    payload_len = 2;  // Write single register or coil
+  } else if (mask_write) {
+    payload_len = 4;  // AND mask and OR mask
+  }
+  // single writes and mask writes have no quantity field
+  bool quantity = !single_write && !mask_write;
+
+  // unit id, function code, start address, quantity (not for single writes), byte count (multiple writes), payload
+  size_t length = 4 + (quantity ? 2 : 0) + (multiple_write && payload != nullptr ? 1 : 0) + payload_len;
+  if (MBAP_HEADER_SIZE - 1 + length > size || length > MBAP_MAX_LENGTH) {
+    return 0;
+  }
+
+  put_mbap_header(buffer, transaction_id, length);
+  uint8_t *pos = buffer + MBAP_HEADER_SIZE - 1;
+  *pos++ = unit_id;
+  *pos++ = function_code;
+  *pos++ = start_address >> 8;
+  *pos++ = start_address >> 0;
+  if (quantity) {
+    *pos++ = number_of_entities >> 8;
+    *pos++ = number_of_entities >> 0;
+  }
+  if (payload != nullptr) {
+    if (multiple_write) {
+      *pos++ = payload_len;  // Byte count is required for write
+    }
+    memcpy(pos, payload, payload_len);
+    pos += payload_len;
+  }
+  return pos - buffer;
+}
+
+size_t encode_raw(uint8_t *buffer, size_t size, uint16_t transaction_id, const uint8_t *data, size_t len) {
+  if (MBAP_HEADER_SIZE - 1 + len > size || len > MBAP_MAX_LENGTH) {
+    return 0;
+  }
+  put_mbap_header(buffer, transaction_id, len);
+  memcpy(buffer + MBAP_HEADER_SIZE - 1, data, len);
+  return MBAP_HEADER_SIZE - 1 + len;
+}
+
+size_t MBAPFrameParser::feed(const uint8_t *data, size_t len) {
+  len = std::min(len, this->free_space());
+  size_t tail = (this->head_ + this->size_) % CAPACITY;
+  size_t written = 0;
+  while (written < len) {
+    // copy up to the end of the ring, then wrap around
+    size_t chunk = std::min(len - written, CAPACITY - tail);
+    memcpy(this->buffer_ + tail, data + written, chunk);
+    // keep the mirrored tail in sync so frames crossing the end of the ring stay contiguous
+    if (tail < MBAP_MAX_ADU_SIZE) {
+      size_t mirror = std::min(chunk, MBAP_MAX_ADU_SIZE - tail);
+      memcpy(this->buffer_ + CAPACITY + tail, data + written, mirror);
+    }
+    written += chunk;
+    tail = (tail + chunk) % CAPACITY;
+  }
+  this->size_ += len;
+  return len;
+}
+
+bool MBAPFrameParser::next_frame(MBAPFrame &frame) {
+  while (this->size_ >= MBAP_HEADER_SIZE) {
+    uint16_t protocol_id = uint16_t(this->peek_(2)) << 8 | this->peek_(3);
+    uint16_t length = uint16_t(this->peek_(4)) << 8 | this->peek_(5);
+    if (protocol_id != 0 || length < MBAP_MIN_LENGTH || length > MBAP_MAX_LENGTH) {
+      // not a valid MBAP header - skip one byte and try to find the next frame boundary
+      this->head_ = (this->head_ + 1) % CAPACITY;
+      this->size_--;
+      this->resync_count_++;
+      continue;
+    }
+    uint16_t adu_len = MBAP_HEADER_SIZE - 1 + length;
+    if (this->size_ < adu_len) {
+      // wait for the rest of the frame
+      return false;
+    }
+    const uint8_t *adu = this->buffer_ + this->head_;
+    frame.transaction_id = uint16_t(adu[0]) << 8 | adu[1];
+    frame.protocol_id = protocol_id;
+    frame.unit_id = adu[6];
+    frame.adu = adu;
+    frame.adu_len = adu_len;
+    frame.pdu = adu + MBAP_HEADER_SIZE;
+    frame.pdu_len = length - 1;
+    this->pending_ = adu_len;
+    return true;
+  }
+  return false;
+}
+
+void MBAPFrameParser::consume() {
+  this->head_ = (this->head_ + this->pending_) % CAPACITY;
+  this->size_ -= this->pending_;
+  this->pending_ = 0;
+  if (this->size_ == 0) {
+    this->head_ = 0;
+  }
+}
+
+void MBAPFrameParser::reset() {
+  this->head_ = 0;
+  this->size_ = 0;
+  this->pending_ = 0;
+}
+
+}  // namespace modbustcp
+}  // namespace esphome
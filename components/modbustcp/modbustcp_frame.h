@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace modbustcp {
+
+/// Modbus TCP application data unit (ADU) layout:
+/// https://modbus.org/docs/Modbus_Messaging_Implementation_Guide_V1_0b.pdf
+// 3.1.3 MBAP Header: transaction id (2) protocol id (2) length (2) unit id (1)
+const uint8_t MBAP_HEADER_SIZE = 7;
+// the length field counts the unit id and the PDU (max 253 bytes)
+const uint16_t MBAP_MIN_LENGTH = 2;
+const uint16_t MBAP_MAX_LENGTH = 254;
+const uint16_t MBAP_MAX_ADU_SIZE = MBAP_HEADER_SIZE - 1 + MBAP_MAX_LENGTH;  // 260
+
+/// A complete Modbus TCP frame as handed out by MBAPFrameParser.
+/// pdu points into the parser buffer and stays valid until the frame is consumed.
+struct MBAPFrame {
+  uint16_t transaction_id{0};
+  uint16_t protocol_id{0};
+  uint8_t unit_id{0};
+  /// function code followed by the function specific data
+  const uint8_t *pdu{nullptr};
+  uint16_t pdu_len{0};
+  /// start of the whole ADU (MBAP header included)
+  const uint8_t *adu{nullptr};
+  uint16_t adu_len{0};
+
+  uint8_t function_code() const { return this->pdu_len > 0 ? this->pdu[0] : 0; }
+};
+
+/** Serialize a request into buffer: MBAP header followed by the PDU.
+ * For write single coil/register the payload holds the 2 byte value, for write multiple coils/registers the byte
+ * count is added in front of the payload. Any other payload is appended after start address and quantity.
+ * @return length of the frame or 0 if it doesn't fit into size bytes
+ */
+size_t encode_request(uint8_t *buffer, size_t size, uint16_t transaction_id, uint8_t unit_id, uint8_t function_code,
+                      uint16_t start_address, uint16_t number_of_entities, uint8_t payload_len = 0,
+                      const uint8_t *payload = nullptr);
+
+/** Serialize unit id and PDU (like a Modbus RTU frame without CRC) into buffer with a MBAP header in front.
+ * @return length of the frame or 0 if it doesn't fit into size bytes
+ */
+size_t encode_raw(uint8_t *buffer, size_t size, uint16_t transaction_id, const uint8_t *data, size_t len);
+
+/// patch the transaction id of an encoded frame
+inline void set_transaction_id(uint8_t *frame, uint16_t transaction_id) {
+  frame[0] = transaction_id >> 8;
+  frame[1] = transaction_id >> 0;
+}
+
+/** Incremental MBAP frame reassembler.
+ *
+ * TCP delivers a byte stream, a single recv() or AsyncTCP data callback can contain a fraction of a response or
+ * several responses back to back. The parser accepts arbitrary chunks, splits them on the MBAP length field and hands
+ * out complete ADUs without copying them.
+ *
+ * The storage is a fixed ring buffer with a mirrored tail: the first MBAP_MAX_ADU_SIZE bytes of the ring are also
+ * written behind its end, so every frame starting anywhere in the ring can be read as one contiguous block.
+ */
+class MBAPFrameParser {
+ public:
+  static const size_t CAPACITY = 1024;
+
+  /// append received bytes. Returns the number of bytes accepted (less than len if the buffer is full)
+  size_t feed(const uint8_t *data, size_t len);
+  /// get the next complete frame. Returns false if more data is needed
+  bool next_frame(MBAPFrame &frame);
+  /// release the frame returned by the last successful next_frame()
+  void consume();
+  /// drop all buffered data (e.g. after a reconnect)
+  void reset();
+
+  size_t available() const { return this->size_; }
+  size_t free_space() const { return CAPACITY - this->size_; }
+  /// number of times the stream was resynchronized because of an invalid MBAP header
+  uint32_t get_resync_count() const { return this->resync_count_; }
+
+ protected:
+  uint8_t peek_(size_t pos) const { return this->buffer_[(this->head_ + pos) % CAPACITY]; }
+
+  uint8_t buffer_[CAPACITY + MBAP_MAX_ADU_SIZE];
+  size_t head_{0};
+  size_t size_{0};
+  /// length of the frame handed out by next_frame() and not consumed yet
+  size_t pending_{0};
+  uint32_t resync_count_{0};
+};
+
+}  // namespace modbustcp
+}  // namespace esphome
@@ -11,6 +11,7 @@ from esphome.const import (
     CONF_NAME,
     CONF_OFFSET,
     CONF_TRIGGER_ID,
+    CONF_UPDATE_INTERVAL,
 )
 from esphome.cpp_helpers import logging
 
@@ -18,19 +19,32 @@ from .const import (
     CONF_ALLOW_DUPLICATE_COMMANDS,
     CONF_BITMASK,
     CONF_BYTE_OFFSET,
+    CONF_COALESCE_WRITES,
+    CONF_COMMAND_QUEUE_SIZE,
     CONF_COMMAND_THROTTLE,
     CONF_CUSTOM_COMMAND,
     CONF_FORCE_NEW_RANGE,
+    CONF_HEARTBEAT_INTERVAL,
+    CONF_LOOP_BUDGET,
+    CONF_LOW_PRIORITY,
     CONF_MAX_CMD_RETRIES,
+    CONF_MAX_GAP,
+    CONF_MAX_REGISTERS_PER_READ,
+    CONF_MAX_REGISTERS_PER_WRITE,
     CONF_MODBUSTCP_CONTROLLER_ID,
     CONF_OFFLINE_SKIP_UPDATES,
     CONF_ON_COMMAND_SENT,
     CONF_ON_OFFLINE,
     CONF_ON_ONLINE,
+    CONF_PERSIST_LEARNED_RANGES,
+    CONF_POLL_JITTER,
+    CONF_PROBE_MAX_REGISTERS,
     CONF_REGISTER_COUNT,
     CONF_REGISTER_TYPE,
     CONF_RESPONSE_SIZE,
     CONF_SKIP_UPDATES,
+    CONF_SKIP_UNCHANGED,
+    CONF_STAGGER_POLLS,
     CONF_VALUE_TYPE,
 )
 
@@ -160,11 +174,29 @@ CONFIG_SCHEMA = cv.All(
         {
             cv.GenerateID(): cv.declare_id(ModbusTCPController),
             cv.Optional(CONF_ALLOW_DUPLICATE_COMMANDS, default=False): cv.boolean,
+            cv.Optional(CONF_COALESCE_WRITES, default=True): cv.boolean,
+            cv.Optional(CONF_COMMAND_QUEUE_SIZE, default=32): cv.int_range(4, 254),
             cv.Optional(
                 CONF_COMMAND_THROTTLE, default="0ms"
             ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_LOOP_BUDGET, default="2ms"
+            ): cv.positive_time_period_microseconds,
             cv.Optional(CONF_MAX_CMD_RETRIES, default=4): cv.positive_int,
+            cv.Optional(CONF_MAX_GAP, default=0): cv.int_range(0, 124),
+            cv.Optional(CONF_PERSIST_LEARNED_RANGES, default=False): cv.boolean,
+            cv.Optional(CONF_MAX_REGISTERS_PER_READ, default=125): cv.int_range(1, 125),
+            cv.Optional(CONF_MAX_REGISTERS_PER_WRITE, default=123): cv.int_range(1, 123),
+            cv.Optional(CONF_PROBE_MAX_REGISTERS, default=False): cv.boolean,
             cv.Optional(CONF_OFFLINE_SKIP_UPDATES, default=0): cv.positive_int,
+            cv.Optional(CONF_STAGGER_POLLS, default=False): cv.boolean,
+            cv.Optional(
+                CONF_POLL_JITTER, default="0ms"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_SKIP_UNCHANGED, default=False): cv.boolean,
+            cv.Optional(
+                CONF_HEARTBEAT_INTERVAL, default="0ms"
+            ): cv.positive_time_period_milliseconds,
             cv.Optional(
                 CONF_SERVER_REGISTERS,
             ): cv.ensure_list(ModbusServerRegisterSchema),
@@ -209,6 +241,8 @@ ModbusItemBaseSchema = cv.Schema(
         cv.Optional(CONF_BITMASK, default=0xFFFFFFFF): cv.hex_uint32_t,
         cv.Optional(CONF_SKIP_UPDATES, default=0): cv.positive_int,
         cv.Optional(CONF_FORCE_NEW_RANGE, default=False): cv.boolean,
+        cv.Optional(CONF_LOW_PRIORITY, default=False): cv.boolean,
+        cv.Optional(CONF_UPDATE_INTERVAL): cv.positive_time_period_milliseconds,
         cv.Optional(CONF_LAMBDA): cv.returning_lambda,
         cv.Optional(CONF_RESPONSE_SIZE, default=0): cv.positive_int,
     },
@@ -280,6 +314,13 @@ async def add_modbus_base_properties(
     if config[CONF_RESPONSE_SIZE] > 0:
         cg.add(var.set_register_size(config[CONF_RESPONSE_SIZE]))
 
+    if config[CONF_LOW_PRIORITY]:
+        cg.add(var.set_low_priority(True))
+
+    # a sort key of the sensor set, the platforms add the item to the controller after this call
+    if CONF_UPDATE_INTERVAL in config:
+        cg.add(var.set_update_interval(config[CONF_UPDATE_INTERVAL]))
+
     if CONF_LAMBDA in config:
         template_ = await cg.process_lambda(
             config[CONF_LAMBDA],
@@ -299,9 +340,21 @@ async def add_modbus_base_properties(
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     cg.add(var.set_allow_duplicate_commands(config[CONF_ALLOW_DUPLICATE_COMMANDS]))
+    cg.add(var.set_coalesce_writes(config[CONF_COALESCE_WRITES]))
+    cg.add(var.set_command_queue_size(config[CONF_COMMAND_QUEUE_SIZE]))
     cg.add(var.set_command_throttle(config[CONF_COMMAND_THROTTLE]))
+    cg.add(var.set_loop_budget(config[CONF_LOOP_BUDGET]))
     cg.add(var.set_max_cmd_retries(config[CONF_MAX_CMD_RETRIES]))
+    cg.add(var.set_max_gap(config[CONF_MAX_GAP]))
+    cg.add(var.set_persist_learned_ranges(config[CONF_PERSIST_LEARNED_RANGES]))
+    cg.add(var.set_max_registers_per_read(config[CONF_MAX_REGISTERS_PER_READ]))
+    cg.add(var.set_max_registers_per_write(config[CONF_MAX_REGISTERS_PER_WRITE]))
+    cg.add(var.set_probe_max_registers(config[CONF_PROBE_MAX_REGISTERS]))
     cg.add(var.set_offline_skip_updates(config[CONF_OFFLINE_SKIP_UPDATES]))
+    cg.add(var.set_stagger_polls(config[CONF_STAGGER_POLLS]))
+    cg.add(var.set_poll_jitter(config[CONF_POLL_JITTER]))
+    cg.add(var.set_skip_unchanged(config[CONF_SKIP_UNCHANGED]))
+    cg.add(var.set_heartbeat_interval(config[CONF_HEARTBEAT_INTERVAL]))
     if CONF_SERVER_REGISTERS in config:
         for server_register in config[CONF_SERVER_REGISTERS]:
             server_register_var = cg.new_Pvariable(
@@ -56,5 +56,5 @@ async def to_code(config):
     await binary_sensor.register_binary_sensor(var, config)
 
     paren = await cg.get_variable(config[CONF_MODBUSTCP_CONTROLLER_ID])
-    cg.add(paren.add_sensor_item(var))
     await add_modbus_base_properties(var, config, ModbusTCPBinarySensor, bool, bool)
+    cg.add(paren.add_sensor_item(var))
@@ -29,6 +29,7 @@ class ModbusTCPBinarySensor : public Component, public binary_sensor::BinarySens
   }
 
   void parse_and_publish(const std::vector<uint8_t> &data) override;
+  bool depends_on_own_bytes() const override { return !this->transform_func_.has_value(); }
   void set_state(bool state) { this->state = state; }
 
   void dump_config() override;
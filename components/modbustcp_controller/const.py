@@ -1,11 +1,22 @@
 CONF_ALLOW_DUPLICATE_COMMANDS = "allow_duplicate_commands"
 CONF_BITMASK = "bitmask"
 CONF_BYTE_OFFSET = "byte_offset"
+CONF_COALESCE_WRITES = "coalesce_writes"
+CONF_COMMAND_QUEUE_SIZE = "command_queue_size"
 CONF_COMMAND_THROTTLE = "command_throttle"
 CONF_OFFLINE_SKIP_UPDATES = "offline_skip_updates"
+CONF_POLL_JITTER = "poll_jitter"
+CONF_PROBE_MAX_REGISTERS = "probe_max_registers"
+CONF_PERSIST_LEARNED_RANGES = "persist_learned_ranges"
 CONF_CUSTOM_COMMAND = "custom_command"
 CONF_FORCE_NEW_RANGE = "force_new_range"
+CONF_HEARTBEAT_INTERVAL = "heartbeat_interval"
+CONF_LOOP_BUDGET = "loop_budget"
+CONF_LOW_PRIORITY = "low_priority"
 CONF_MAX_CMD_RETRIES = "max_cmd_retries"
+CONF_MAX_GAP = "max_gap"
+CONF_MAX_REGISTERS_PER_READ = "max_registers_per_read"
+CONF_MAX_REGISTERS_PER_WRITE = "max_registers_per_write"
 CONF_MODBUSTCP_CONTROLLER_ID = "modbustcp_controller_id"
 CONF_MODBUS_FUNCTIONCODE = "modbus_functioncode"
 CONF_ON_COMMAND_SENT = "on_command_sent"
@@ -15,7 +26,10 @@ CONF_RAW_ENCODE = "raw_encode"
 CONF_REGISTER_COUNT = "register_count"
 CONF_REGISTER_TYPE = "register_type"
 CONF_RESPONSE_SIZE = "response_size"
+CONF_SKIP_UNCHANGED = "skip_unchanged"
 CONF_SKIP_UPDATES = "skip_updates"
+CONF_STAGGER_POLLS = "stagger_polls"
+CONF_USE_MASK_WRITE = "use_mask_write"
 CONF_USE_WRITE_MULTIPLE = "use_write_multiple"
 CONF_VALUE_TYPE = "value_type"
 CONF_WRITE_LAMBDA = "write_lambda"
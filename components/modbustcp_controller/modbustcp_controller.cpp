@@ -1,27 +1,290 @@
 #include "modbustcp_controller.h"
 #include "esphome/core/application.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
-#include "esp_timer.h"
+
+#include <algorithm>
+#include <cstring>
 
 namespace esphome {
 namespace modbustcp_controller {
 
 static const char *const TAG = "modbustcp_controller";
 
-void ModbusTCPController::setup() { this->create_register_ranges_(); }
+/// learned entry flags
+static const uint32_t LEARNED_SPLIT = 0;
+static const uint32_t LEARNED_HOLE = 1UL << 31;
+
+static uint32_t learned_key(ModbusRegisterType register_type, uint16_t address) {
+  return uint32_t(register_type) << 16 | address;
+}
+
+/// big-endian words of the response as they are read by get_data()
+static uint16_t be16(const uint8_t *data) { return uint16_t(data[0]) << 8 | data[1]; }
+static uint32_t be32(const uint8_t *data) { return uint32_t(be16(data)) << 16 | be16(data + 2); }
+static uint64_t be64(const uint8_t *data) { return uint64_t(be32(data)) << 32 | be32(data + 4); }
+
+/** Decoders of the range decode plan, one instance per value type.
+ * They give the same results as payload_to_number(), but the switch on the value type, the bounds check and the
+ * search of the shift are done once when the plan is built. A mask without bits inside the value is stored as 0.
+ */
+template<SensorValueType V> int64_t decode_number(const uint8_t *data, uint32_t mask, uint8_t shift);
+
+template<> int64_t decode_number<SensorValueType::U_WORD>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return uint16_t((mask & be16(data)) >> shift);
+}
+template<> int64_t decode_number<SensorValueType::S_WORD>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return int16_t((mask & uint32_t(int16_t(be16(data)))) >> shift);
+}
+template<> int64_t decode_number<SensorValueType::U_DWORD>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return uint32_t((mask & be32(data)) >> shift);
+}
+template<> int64_t decode_number<SensorValueType::S_DWORD>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return int32_t((mask & be32(data)) >> shift);
+}
+template<> int64_t decode_number<SensorValueType::U_DWORD_R>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return uint32_t((mask & (uint32_t(be16(data + 2)) << 16 | be16(data))) >> shift);
+}
+template<> int64_t decode_number<SensorValueType::S_DWORD_R>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return int32_t((mask & (uint32_t(be16(data + 2)) << 16 | be16(data))) >> shift);
+}
+// QWORD values ignore the bitmask
+template<> int64_t decode_number<SensorValueType::U_QWORD>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return be64(data);
+}
+template<> int64_t decode_number<SensorValueType::U_QWORD_R>(const uint8_t *data, uint32_t mask, uint8_t shift) {
+  return uint64_t(be16(data + 6)) << 48 | uint64_t(be16(data + 4)) << 32 | uint32_t(be16(data + 2)) << 16 |
+         be16(data);
+}
+
+/// the decoder and the bytes read for a value type, nullptr if the sensor has to parse the response itself
+static DecodeFunc value_decoder(SensorValueType value_type, uint8_t &size) {
+  switch (value_type) {
+    case SensorValueType::U_WORD:
+      size = 2;
+      return decode_number<SensorValueType::U_WORD>;
+    case SensorValueType::S_WORD:
+      size = 2;
+      return decode_number<SensorValueType::S_WORD>;
+    case SensorValueType::U_DWORD:
+    case SensorValueType::FP32:
+      size = 4;
+      return decode_number<SensorValueType::U_DWORD>;
+    case SensorValueType::S_DWORD:
+      size = 4;
+      return decode_number<SensorValueType::S_DWORD>;
+    case SensorValueType::U_DWORD_R:
+    case SensorValueType::FP32_R:
+      size = 4;
+      return decode_number<SensorValueType::U_DWORD_R>;
+    case SensorValueType::S_DWORD_R:
+      size = 4;
+      return decode_number<SensorValueType::S_DWORD_R>;
+    case SensorValueType::U_QWORD:
+    case SensorValueType::S_QWORD:
+      size = 8;
+      return decode_number<SensorValueType::U_QWORD>;
+    case SensorValueType::U_QWORD_R:
+    case SensorValueType::S_QWORD_R:
+      size = 8;
+      return decode_number<SensorValueType::U_QWORD_R>;
+    default:
+      size = 0;
+      return nullptr;
+  }
+}
+
+/// heap order of the poll schedule: the earliest deadline on top, millis() may wrap
+static bool due_later(const ScheduledPoll &a, const ScheduledPoll &b) { return int32_t(a.due - b.due) > 0; }
+
+void ModbusTCPController::setup() {
+  if (this->persist_learned_ranges_) {
+    // a new configuration starts with a new plan
+    uint32_t hash = fnv1_hash(str_sprintf("modbustcp_controller_%u", this->address_)) ^ App.get_config_hash();
+    this->learned_plan_pref_ = global_preferences->make_preference<LearnedRangePlan>(hash);
+    LearnedRangePlan plan{};
+    if (this->learned_plan_pref_.load(&plan) && plan.count <= MAX_LEARNED_RANGE_ENTRIES) {
+      this->learned_plan_.assign(plan.entries, plan.entries + plan.count);
+      ESP_LOGD(TAG, "Restored %u learned range entries", plan.count);
+    }
+  }
+  this->create_register_ranges_();
+  this->init_command_slots_();
+}
 
 /*
  To work with the existing modbus class and avoid polling for responses a command queue is used.
- send_next_command will submit the command at the top of the queue and set the corresponding callback
- to handle the response from the device.
- Once the response has been processed it is removed from the queue and the next command is sent
+ The transport pulls the commands at the top of the queue through send_pending_request() as long as its window
+ of outstanding transactions has room, alternating between the devices on the connection. Sent commands wait in the in-flight list until the response with their transaction id
+ arrives, a timeout moves them back to the front of the queue to be retried.
+
+ All commands live in a fixed number of slots allocated in setup(). The send queue, the in-flight list and the
+ response queue only hold slot indexes. Queued commands are also chained into a small hash index on
+ dedup_key() so queue_command() finds a duplicate without walking the queue.
+*/
+
+void ModbusTCPController::init_command_slots_() {
+  size_t capacity = std::max<size_t>(this->command_queue_size_, this->register_ranges_.size() + MIN_FREE_COMMAND_SLOTS);
+  capacity = std::min<size_t>(capacity, NO_COMMAND_SLOT);
+  this->command_slots_.resize(capacity);
+  this->free_slots_.clear();
+  this->free_slots_.reserve(capacity);
+  for (size_t i = capacity; i > 0; i--) {
+    // responses and write payloads never get larger than a PDU
+    this->command_slots_[i - 1].command.payload.reserve(modbustcp::MBAP_MAX_LENGTH);
+    this->free_slots_.push_back(i - 1);
+  }
+  for (auto &queue : this->command_queues_) {
+    queue.init(capacity);
+  }
+  this->incoming_queue_.init(capacity);
+  this->inflight_.reserve(capacity);
+  size_t buckets = 1;
+  while (buckets < capacity) {
+    buckets <<= 1;
+  }
+  this->dedup_buckets_.assign(buckets, NO_COMMAND_SLOT);
+}
+
+void ModbusTCPController::grow_command_slots_() {
+  // splitting on illegal data addresses and a lower max_registers_per_read create more ranges
+  size_t capacity = this->command_slots_.size();
+  size_t needed = std::min<size_t>(this->register_ranges_.size() + MIN_FREE_COMMAND_SLOTS, NO_COMMAND_SLOT);
+  if (needed <= capacity) {
+    return;
+  }
+  ESP_LOGD(TAG, "Growing the command slots from %u to %u for %u ranges", (unsigned) capacity, (unsigned) needed,
+           (unsigned) this->register_ranges_.size());
+  // queued commands are referenced by slot index, moving the slots keeps them valid
+  this->command_slots_.resize(needed);
+  for (size_t i = needed; i > capacity; i--) {
+    this->command_slots_[i - 1].command.payload.reserve(modbustcp::MBAP_MAX_LENGTH);
+    this->free_slots_.push_back(i - 1);
+  }
+  for (auto &queue : this->command_queues_) {
+    queue.grow(needed);
+  }
+  this->incoming_queue_.grow(needed);
+  this->inflight_.reserve(needed);
+  // the duplicate index keeps its bucket count, the chains just get longer
+}
+
+uint8_t ModbusTCPController::alloc_slot_() {
+  if (this->free_slots_.empty()) {
+    return NO_COMMAND_SLOT;
+  }
+  uint8_t slot = this->free_slots_.back();
+  this->free_slots_.pop_back();
+  return slot;
+}
+
+void ModbusTCPController::index_add_(uint8_t slot) {
+  auto &entry = this->command_slots_[slot];
+  entry.key = entry.command.dedup_key();
+  auto &head = this->dedup_buckets_[this->bucket_(entry.key)];
+  entry.next = head;
+  head = slot;
+}
+
+void ModbusTCPController::enqueue_slot_(uint8_t slot, bool front) {
+  auto &entry = this->command_slots_[slot];
+  this->index_add_(slot);
+  auto &queue = this->command_queues_[uint8_t(entry.command.priority)];
+  if (front) {
+    queue.push_front(slot);
+  } else {
+    queue.push_back(slot);
+  }
+}
+
+/*
+  The send queues are served by strict priority: a write goes out with the next free transaction even if a full
+  poll cycle is queued. To keep polls alive under a steady stream of writes or on-demand reads, a waiting queue
+  that was passed over PRIORITY_STARVATION_LIMIT times is served once before the higher ones again.
 */
+int8_t ModbusTCPController::next_queue_() const {
+  int8_t next = -1;
+  for (uint8_t i = 0; i < NUM_COMMAND_PRIORITIES; i++) {
+    if (this->command_queues_[i].empty()) {
+      continue;
+    }
+    if (next < 0) {
+      next = i;
+    } else if (this->passed_over_[i] >= PRIORITY_STARVATION_LIMIT) {
+      return i;
+    }
+  }
+  return next;
+}
+
+uint8_t ModbusTCPController::dequeue_slot_(uint8_t queue) {
+  uint8_t slot = this->command_queues_[queue].front();
+  this->command_queues_[queue].pop_front();
+  this->index_remove_(slot);
+  for (uint8_t i = 0; i < NUM_COMMAND_PRIORITIES; i++) {
+    if (i == queue || this->command_queues_[i].empty()) {
+      this->passed_over_[i] = 0;
+    } else if (i > queue) {
+      this->passed_over_[i]++;
+    }
+  }
+  return slot;
+}
+
+size_t ModbusTCPController::queued_commands_() const {
+  size_t count = 0;
+  for (const auto &queue : this->command_queues_) {
+    count += queue.size();
+  }
+  return count;
+}
+
+void ModbusTCPController::index_remove_(uint8_t slot) {
+  uint8_t *link = &this->dedup_buckets_[this->bucket_(this->command_slots_[slot].key)];
+  while (*link != NO_COMMAND_SLOT) {
+    if (*link == slot) {
+      *link = this->command_slots_[slot].next;
+      return;
+    }
+    link = &this->command_slots_[*link].next;
+  }
+}
 
-bool ModbusTCPController::send_next_command_() {
-  uint32_t last_send = (esp_timer_get_time() / 1000) - this->last_command_timestamp_;
+uint8_t ModbusTCPController::find_queued_(const ModbusCommandItem &command, uint32_t key) const {
+  if (this->dedup_buckets_.empty()) {
+    // not set up yet
+    return NO_COMMAND_SLOT;
+  }
+  uint8_t slot = this->dedup_buckets_[this->bucket_(key)];
+  while (slot != NO_COMMAND_SLOT) {
+    const auto &entry = this->command_slots_[slot];
+    // the full compare (whole payload for custom commands) only runs for a matching hash
+    if (entry.key == key && entry.command.is_equal(command)) {
+      return slot;
+    }
+    slot = entry.next;
+  }
+  return NO_COMMAND_SLOT;
+}
+
+bool ModbusTCPController::has_pending_request() {
+  return this->next_queue_() >= 0 && millis() - this->last_command_timestamp_ > this->command_throttle_;
+}
 
-  if ((last_send > this->command_throttle_) && !waiting_for_response() && !this->command_queue_.empty()) {
-    auto &command = this->command_queue_.front();
+bool ModbusTCPController::send_pending_request() {
+  while (true) {
+    int8_t queue = this->next_queue_();
+    if (queue < 0) {
+      return false;
+    }
+    uint32_t last_send = millis() - this->last_command_timestamp_;
+    if (last_send <= this->command_throttle_) {
+      return false;
+    }
+
+    uint8_t slot = this->command_queues_[queue].front();
+    auto *command = &this->command_slots_[slot].command;
     // remove from queue if command was sent too often
     if (!command->should_retry(this->max_cmd_retries_)) {
       if (!this->module_offline_) {
@@ -39,76 +302,294 @@ bool ModbusTCPController::send_next_command_() {
       }
       ESP_LOGD(TAG, "Modbus command to device=%d register=0x%02X no response received - removed from send queue",
                this->address_, command->register_address);
-      this->command_queue_.pop_front();
-    } else {
-      ESP_LOGV(TAG, "Sending next modbus command to device %d register 0x%02X count %d", this->address_,
-               command->register_address, command->register_count);
-      command->send();
+      this->dequeue_slot_(queue);
+      if (command->on_error_func) {
+        command->on_error_func(0);
+      }
+      this->release_slot_(slot);
+      continue;
+    }
 
-      this->last_command_timestamp_ = esp_timer_get_time() / 1000;
+    ESP_LOGV(TAG, "Sending next modbus command to device %d register 0x%02X count %d", this->address_,
+             command->register_address, command->register_count);
+    bool sent = command->send();
 
-      this->command_sent_callback_.call((int) command->function_code, command->register_address);
+    this->last_command_timestamp_ = millis();
 
-      // remove from queue if no handler is defined
-      if (!command->on_data_func) {
-        this->command_queue_.pop_front();
-      }
+    this->command_sent_callback_.call((int) command->function_code, command->register_address);
+
+    if (!sent) {
+      // not connected - the command stays at the front and counts as a failed attempt
+      return false;
     }
+    // remove from queue. Commands without handler don't wait for a response
+    this->dequeue_slot_(queue);
+    if (command->expects_response()) {
+      this->inflight_.push_back(slot);
+    } else {
+      this->release_slot_(slot);
+    }
+    return true;
   }
-  return (!this->command_queue_.empty());
+}
 
+std::vector<uint8_t>::iterator ModbusTCPController::find_inflight_(uint16_t transaction_id) {
+  return std::find_if(this->inflight_.begin(), this->inflight_.end(), [this, transaction_id](uint8_t slot) {
+    return this->command_slots_[slot].command.transaction_id == transaction_id;
+  });
 }
 
 // Queue incoming response
-void ModbusTCPController::on_modbus_data(const std::vector<uint8_t> &data) {
-  auto &current_command = this->command_queue_.front();
-  if (current_command != nullptr) {
-    if (this->module_offline_) {
-      ESP_LOGW(TAG, "Modbus device=%d back online", this->address_);
-
-      if (this->offline_skip_updates_ > 0) {
-        // Restore skip_updates_counter to restore commands updates
-        for (auto &r : this->register_ranges_) {
-          r.skip_updates_counter = 0;
-        }
+void ModbusTCPController::on_modbus_data(uint16_t transaction_id, const std::vector<uint8_t> &data) {
+  auto it = this->find_inflight_(transaction_id);
+  if (it == this->inflight_.end()) {
+    // not waiting for this transaction anymore
+    return;
+  }
+  uint8_t slot = *it;
+  auto *current_command = &this->command_slots_[slot].command;
+  if (this->module_offline_) {
+    ESP_LOGW(TAG, "Modbus device=%d back online", this->address_);
+
+    if (this->offline_skip_updates_ > 0) {
+      // Restore skip_updates_counter to restore commands updates
+      for (auto &r : this->register_ranges_) {
+        r.skip_updates_counter = 0;
       }
-      // Restore module online state
-      this->module_offline_ = false;
-      this->online_callback_.call((int) current_command->function_code, current_command->register_address);
     }
-
-    // Move the commandItem to the response queue
-    current_command->payload = data;
-    this->incoming_queue_.push(std::move(current_command));
-    ESP_LOGV(TAG, "Modbus response queued");
-    this->command_queue_.pop_front();
+    // Restore module online state
+    this->module_offline_ = false;
+    this->online_callback_.call((int) current_command->function_code, current_command->register_address);
   }
+
+  // Move the commandItem to the response queue. The payload fits into the reserved capacity
+  current_command->payload = data;
+  this->incoming_queue_.push_back(slot);
+  ESP_LOGV(TAG, "Modbus response queued");
+  this->erase_inflight_(it);
 }
 
 // Dispatch the response to the registered handler
 void ModbusTCPController::process_modbus_data_(const ModbusCommandItem *response) {
   ESP_LOGV(TAG, "Process modbus response for address 0x%X size: %zu", response->register_address,
            response->payload.size());
-  response->on_data_func(response->register_type, response->register_address, response->payload);
+  if (response->range_index >= 0) {
+    this->on_range_data_(response->range_index, response->payload);
+  } else {
+    response->on_data_func(response->register_type, response->register_address, response->payload);
+  }
 }
 
-void ModbusTCPController::on_modbus_error(uint8_t function_code, uint8_t exception_code) {
+void ModbusTCPController::on_modbus_error(uint16_t transaction_id, uint8_t function_code, uint8_t exception_code) {
+  auto it = this->find_inflight_(transaction_id);
+  if (it == this->inflight_.end()) {
+    return;
+  }
   ESP_LOGE(TAG, "Modbus error function code: 0x%X exception: %d ", function_code, exception_code);
   // Remove pending command waiting for a response
-  auto &current_command = this->command_queue_.front();
-  if (current_command != nullptr) {
-    ESP_LOGE(TAG,
-             "Modbus error - last command: function code=0x%X  register address = 0x%X  "
-             "registers count=%d "
-             "payload size=%zu",
-             function_code, current_command->register_address, current_command->register_count,
-             current_command->payload.size());
-    this->command_queue_.pop_front();
+  uint8_t slot = *it;
+  auto *current_command = &this->command_slots_[slot].command;
+  ESP_LOGE(TAG,
+           "Modbus error - last command: function code=0x%X  register address = 0x%X  "
+           "registers count=%d "
+           "payload size=%zu",
+           function_code, current_command->register_address, current_command->register_count,
+           current_command->payload.size());
+  if (exception_code == uint8_t(modbustcp::ModbusExceptionCode::ILLEGAL_DATA_ADDRESS) &&
+      current_command->range_index >= 0 && !this->replan_pending_) {
+    this->learn_illegal_range_(current_command->range_index);
+  }
+  this->erase_inflight_(it);
+  if (current_command->on_error_func) {
+    current_command->on_error_func(exception_code);
+  }
+  this->release_slot_(slot);
+}
+
+/*
+  Many devices reject reads smaller than the 125 registers allowed by the spec. The probe reads at the start of the
+  largest register range: one register to check that the device answers, then the configured maximum, then a binary
+  search between the largest count that worked and the smallest that failed (exception or no response). The result
+  never drops below the largest valid range, because that range is readable from the probe address.
+*/
+void ModbusTCPController::start_probe_() {
+  const RegisterRange *largest = nullptr;
+  for (auto &r : this->register_ranges_) {
+    if ((r.register_type == ModbusRegisterType::HOLDING || r.register_type == ModbusRegisterType::READ) &&
+        !r.disabled && (largest == nullptr || r.register_count > largest->register_count)) {
+      largest = &r;
+    }
+  }
+  if (largest == nullptr) {
+    this->probe_done_ = true;
+    return;
+  }
+  this->probing_ = true;
+  this->probe_type_ = largest->register_type;
+  this->probe_address_ = largest->start_address;
+  this->probe_low_ = 1;
+  this->probe_high_ = this->max_registers_per_read_;
+  this->probe_answered_ = false;
+  ESP_LOGD(TAG, "Probing max registers per read at 0x%X", this->probe_address_);
+  this->send_probe_(1);
+}
+
+void ModbusTCPController::probe_step_() {
+  if (this->probe_low_ >= this->probe_high_) {
+    this->probing_ = false;
+    this->probe_done_ = true;
+    ESP_LOGI(TAG, "Modbus device=%d accepts reads of up to %u registers", this->address_, this->probe_low_);
+    if (this->probe_low_ < this->max_registers_per_read_) {
+      this->max_registers_per_read_ = this->probe_low_;
+      this->replan_pending_ = true;
+    }
+    return;
   }
+  this->send_probe_((this->probe_low_ + this->probe_high_ + 1) / 2);
+}
+
+void ModbusTCPController::send_probe_(uint16_t count) {
+  auto cmd = ModbusCommandItem::create_read_command(
+      this, this->probe_type_, this->probe_address_, count,
+      [this, count](ModbusRegisterType register_type, uint16_t start_address, const std::vector<uint8_t> &data) {
+        this->probe_low_ = count;
+        if (!this->probe_answered_) {
+          // the device answers - try the configured maximum first, most devices accept it
+          this->probe_answered_ = true;
+          if (this->probe_high_ > this->probe_low_) {
+            this->send_probe_(this->probe_high_);
+            return;
+          }
+        }
+        this->probe_step_();
+      });
+  cmd.on_error_func = [this, count](uint8_t exception_code) {
+    ESP_LOGD(TAG, "Probe read of %u registers failed (exception %u)", count, exception_code);
+    if (!this->probe_answered_) {
+      // no answer at all: try again with the next update. A single register can't be read here: keep the limit
+      this->probing_ = false;
+      this->probe_done_ = exception_code != 0;
+      return;
+    }
+    this->probe_high_ = count - 1;
+    this->probe_step_();
+  };
+  this->queue_command(cmd);
 }
 
-void ModbusTCPController::on_modbus_read_registers(uint8_t function_code, uint16_t start_address,
-                                                uint16_t number_of_registers) {
+/*
+  A merged range can cover an address the device doesn't implement, the device then rejects the whole read with
+  ILLEGAL DATA ADDRESS. The range is split at its middle sensor address, every failing half is split again until the
+  failing sensor is alone in its range. That range is disabled. Each split costs one poll cycle of the range.
+  The learned splits and holes can be kept in the preferences (persist_learned_ranges).
+*/
+void ModbusTCPController::learn_illegal_range_(size_t range_index) {
+  const auto &r = this->register_ranges_[range_index];
+  if (r.register_type == ModbusRegisterType::CUSTOM) {
+    return;
+  }
+  std::vector<uint16_t> addresses;
+  for (auto *item : r.sensors) {
+    addresses.push_back(item->configured_address);
+  }
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+  if (addresses.empty()) {
+    return;
+  }
+
+  if (addresses.size() > 1) {
+    uint16_t split = addresses[addresses.size() / 2];
+    ESP_LOGW(TAG, "Range 0x%X count %u: illegal data address - splitting at 0x%X", r.start_address, r.register_count,
+             split);
+    this->learned_plan_.push_back(learned_key(r.register_type, split) | LEARNED_SPLIT);
+  } else {
+    ESP_LOGW(TAG, "Register 0x%X type %u: illegal data address - no longer polled", addresses[0],
+             static_cast<uint8_t>(r.register_type));
+    // a hole always gets its own range. The splits that led to it are dropped so its neighbours merge again: the
+    // ones between the ranges the bisection carved out of the original range, other ranges keep their splits.
+    // Splits still needed because of holes in unused registers are learned again in the next cycles
+    auto split_before = [this](size_t index) {
+      const auto &range = this->register_ranges_[index];
+      return index > 0 && this->register_ranges_[index - 1].register_type == range.register_type &&
+             this->has_learned_entry_(range.register_type, range.start_address, LEARNED_SPLIT);
+    };
+    size_t first = range_index;
+    while (split_before(first)) {
+      first--;
+    }
+    size_t last = range_index;
+    while (last + 1 < this->register_ranges_.size() && split_before(last + 1)) {
+      last++;
+    }
+    for (size_t i = first + 1; i <= last; i++) {
+      uint32_t key = learned_key(r.register_type, this->register_ranges_[i].start_address) | LEARNED_SPLIT;
+      this->learned_plan_.erase(std::remove(this->learned_plan_.begin(), this->learned_plan_.end(), key),
+                                this->learned_plan_.end());
+    }
+    this->learned_plan_.push_back(learned_key(r.register_type, addresses[0]) | LEARNED_HOLE);
+  }
+  this->replan_pending_ = true;
+}
+
+bool ModbusTCPController::has_learned_entry_(ModbusRegisterType register_type, uint16_t address,
+                                             uint32_t flag) const {
+  uint32_t key = learned_key(register_type, address) | flag;
+  return std::find(this->learned_plan_.begin(), this->learned_plan_.end(), key) != this->learned_plan_.end();
+}
+
+void ModbusTCPController::replan_ranges_() {
+  this->replan_pending_ = false;
+  // queued and in-flight range reads refer to the old range indexes
+  auto is_range_read = [this](uint8_t slot) {
+    if (this->command_slots_[slot].command.range_index < 0) {
+      return false;
+    }
+    this->release_slot_(slot);
+    return true;
+  };
+  for (auto &queue : this->command_queues_) {
+    queue.remove_if([this, &is_range_read](uint8_t slot) {
+      if (this->command_slots_[slot].command.range_index >= 0) {
+        this->index_remove_(slot);
+      }
+      return is_range_read(slot);
+    });
+  }
+  this->inflight_.erase(std::remove_if(this->inflight_.begin(), this->inflight_.end(), is_range_read),
+                        this->inflight_.end());
+  // received data of the old ranges would be dispatched to the wrong sensors
+  this->incoming_queue_.remove_if(is_range_read);
+  this->create_register_ranges_();
+  this->grow_command_slots_();
+
+  if (this->persist_learned_ranges_) {
+    LearnedRangePlan plan{};
+    if (this->learned_plan_.size() > MAX_LEARNED_RANGE_ENTRIES) {
+      ESP_LOGW(TAG, "%u learned range entries, only the first %u are kept after a restart",
+               (unsigned) this->learned_plan_.size(), MAX_LEARNED_RANGE_ENTRIES);
+    }
+    plan.count = std::min<size_t>(this->learned_plan_.size(), MAX_LEARNED_RANGE_ENTRIES);
+    std::copy_n(this->learned_plan_.begin(), plan.count, plan.entries);
+    this->learned_plan_pref_.save(&plan);
+  }
+}
+
+void ModbusTCPController::on_modbus_timeout(uint16_t transaction_id) {
+  auto it = this->find_inflight_(transaction_id);
+  if (it == this->inflight_.end()) {
+    return;
+  }
+  // resend it next - should_retry() decides if it is dropped
+  uint8_t slot = *it;
+  ESP_LOGV(TAG, "Modbus command to device=%d register=0x%02X timed out", this->address_,
+           this->command_slots_[slot].command.register_address);
+  this->erase_inflight_(it);
+  this->enqueue_slot_(slot, true);
+}
+
+void ModbusTCPController::on_modbus_read_registers(uint16_t transaction_id, uint8_t function_code,
+                                                uint16_t start_address, uint16_t number_of_registers) {
   ESP_LOGD(TAG,
            "Received read holding/input registers for device 0x%X. FC: 0x%X. Start address: 0x%X. Number of registers: "
            "0x%X.",
@@ -139,22 +620,28 @@ void ModbusTCPController::on_modbus_read_registers(uint8_t function_code, uint16
 
     if (!found) {
       ESP_LOGW(TAG, "Could not match any register to address %02X. Sending exception response.", current_address);
-      send_error(function_code, 0x02);
+      send_error(transaction_id, function_code, 0x02);
       return;
     }
   }
 
+  // unit id, function code, byte count, register values
   std::vector<uint8_t> response;
+  response.reserve(3 + sixteen_bit_response.size() * 2);
+  response.push_back(this->address_);
+  response.push_back(function_code);
+  response.push_back(sixteen_bit_response.size() * 2);
   for (auto v : sixteen_bit_response) {
     auto decoded_value = decode_value(v);
     response.push_back(decoded_value[0]);
     response.push_back(decoded_value[1]);
   }
 
-  this->send(function_code, start_address, number_of_registers, response.size(), response.data());
+  this->send_response(transaction_id, response);
 }
 
-void ModbusTCPController::on_modbus_write_registers(uint8_t function_code, const std::vector<uint8_t> &data) {
+void ModbusTCPController::on_modbus_write_registers(uint16_t transaction_id, uint8_t function_code,
+                                                 const std::vector<uint8_t> &data) {
   uint16_t number_of_registers;
   uint16_t payload_offset;
 
@@ -162,14 +649,14 @@ void ModbusTCPController::on_modbus_write_registers(uint8_t function_code, const
     number_of_registers = uint16_t(data[3]) | (uint16_t(data[2]) << 8);
     if (number_of_registers == 0 || number_of_registers > 0x7B) {
       ESP_LOGW(TAG, "Invalid number of registers %d. Sending exception response.", number_of_registers);
-      send_error(function_code, 3);
+      send_error(transaction_id, function_code, 3);
       return;
     }
     uint16_t payload_size = data[4];
     if (payload_size != number_of_registers * 2) {
       ESP_LOGW(TAG, "Payload size of %d bytes is not 2 times the number of registers (%d). Sending exception response.",
                payload_size, number_of_registers);
-      send_error(function_code, 3);
+      send_error(transaction_id, function_code, 3);
       return;
     }
     payload_offset = 5;
@@ -178,7 +665,7 @@ void ModbusTCPController::on_modbus_write_registers(uint8_t function_code, const
     payload_offset = 2;
   } else {
     ESP_LOGW(TAG, "Invalid function code 0x%X. Sending exception response.", function_code);
-    send_error(function_code, 1);
+    send_error(transaction_id, function_code, 1);
     return;
   }
 
@@ -213,7 +700,7 @@ void ModbusTCPController::on_modbus_write_registers(uint8_t function_code, const
   if (!for_each_register([](ServerRegister *server_register, uint16_t offset) -> bool {
         return server_register->write_lambda != nullptr;
       })) {
-    send_error(function_code, 1);
+    send_error(transaction_id, function_code, 1);
     return;
   }
 
@@ -222,7 +709,7 @@ void ModbusTCPController::on_modbus_write_registers(uint8_t function_code, const
         int64_t number = payload_to_number(data, server_register->value_type, offset, 0xFFFFFFFF);
         return server_register->write_lambda(number);
       })) {
-    send_error(function_code, 4);
+    send_error(transaction_id, function_code, 4);
     return;
   }
 
@@ -231,94 +718,561 @@ void ModbusTCPController::on_modbus_write_registers(uint8_t function_code, const
   response.push_back(this->address_);
   response.push_back(function_code);
   response.insert(response.end(), data.begin(), data.begin() + 4);
-  this->send_raw(response);
+  this->send_response(transaction_id, response);
 }
 
-SensorSet ModbusTCPController::find_sensors_(ModbusRegisterType register_type, uint16_t start_address) const {
+const RegisterRange *ModbusTCPController::find_range_(ModbusRegisterType register_type,
+                                                      uint16_t start_address) const {
   auto reg_it = std::find_if(
       std::begin(this->register_ranges_), std::end(this->register_ranges_),
       [=](RegisterRange const &r) { return (r.start_address == start_address && r.register_type == register_type); });
 
   if (reg_it == this->register_ranges_.end()) {
     ESP_LOGE(TAG, "No matching range for sensor found - start_address : 0x%X", start_address);
-  } else {
-    return reg_it->sensors;
+    return nullptr;
   }
-
-  // not found
-  return {};
+  return &*reg_it;
 }
+
 void ModbusTCPController::on_register_data(ModbusRegisterType register_type, uint16_t start_address,
                                         const std::vector<uint8_t> &data) {
   ESP_LOGV(TAG, "data for register address : 0x%X : ", start_address);
 
-  // loop through all sensors with the same start address
-  auto sensors = find_sensors_(register_type, start_address);
-  for (auto *sensor : sensors) {
-    sensor->parse_and_publish(data);
+  // the range with this start address, dispatched like a poll
+  const auto *r = this->find_range_(register_type, start_address);
+  if (r == nullptr) {
+    return;
   }
+  this->on_range_data_(r - this->register_ranges_.data(), data);
+}
+
+void ModbusTCPController::on_range_data_(size_t range_index, const std::vector<uint8_t> &data) {
+  if (range_index >= this->register_ranges_.size()) {
+    return;
+  }
+  auto &r = this->register_ranges_[range_index];
+  const auto &plan = r.decode_plan;
+  auto *values = this->decoded_values_.data();
+  auto *unchanged = this->unchanged_steps_.data();
+  /* With skip_unchanged the last response of the range is kept. A response equal to it publishes nothing,
+   * otherwise only the sensors whose own bytes changed (or which parse the whole response) publish.
+   * The heartbeat publishes all sensors of the range again.
+   */
+  bool compare = false;
+  if (this->skip_unchanged_) {
+    uint32_t now = millis();
+    bool heartbeat = this->heartbeat_interval_ > 0 && now - r.last_publish >= this->heartbeat_interval_;
+    compare = !heartbeat && r.last_data.size() == data.size();
+    if (compare && r.last_data == data) {
+      ESP_LOGV(TAG, "Range 0x%X unchanged", r.start_address);
+      return;
+    }
+    if (!compare) {
+      r.last_publish = now;
+    } else if (!r.coil_steps.empty()) {
+      this->publish_flipped_coils_(r, data);
+      if (r.coil_steps.size() == plan.size()) {
+        r.last_data = data;
+        return;
+      }
+    }
+  }
+  // one pass decodes all values of the range, the second one publishes them
+  for (size_t i = 0; i < plan.size(); i++) {
+    const auto &step = plan[i];
+    unchanged[i] = compare && ((step.own_bytes && step.offset + step.size <= data.size() &&
+                                memcmp(data.data() + step.offset, r.last_data.data() + step.offset, step.size) == 0) ||
+                               step.own_bit);
+    if (step.decode == nullptr || unchanged[i]) {
+      continue;
+    }
+    if (step.offset + step.size > data.size()) {
+      ESP_LOGE(TAG, "not enough data for value");
+      values[i] = 0;
+      continue;
+    }
+    values[i] = step.decode(data.data() + step.offset, step.mask, step.shift);
+  }
+  if (this->skip_unchanged_) {
+    r.last_data = data;
+  }
+  for (size_t i = 0; i < plan.size(); i++) {
+    if (unchanged[i]) {
+      continue;
+    }
+    if (plan[i].decode != nullptr) {
+      plan[i].item->publish_number(values[i], data);
+    } else {
+      plan[i].item->parse_and_publish(data);
+    }
+  }
+}
+
+/// bits 0-31 of a coil bitmap starting at pos: coil n is bit n % 8 of byte n / 8
+static uint32_t coil_word(const std::vector<uint8_t> &data, size_t pos) {
+  uint32_t word = 0;
+  for (size_t i = 0; i < 4 && pos + i < data.size(); i++) {
+    word |= uint32_t(data[pos + i]) << (i * 8);
+  }
+  return word;
+}
+
+void ModbusTCPController::publish_flipped_coils_(const RegisterRange &r, const std::vector<uint8_t> &data) {
+  /* XOR the last and the new bitmap a word at a time, only the items of the flipped coils are visited.
+   * The caller has checked that both responses have the same size.
+   */
+  for (size_t pos = 0; pos < data.size(); pos += 4) {
+    uint32_t flipped = coil_word(data, pos) ^ coil_word(r.last_data, pos);
+    while (flipped != 0) {
+      uint16_t coil = pos * 8 + __builtin_ctz(flipped);
+      flipped &= flipped - 1;
+      auto it = std::lower_bound(r.coil_steps.begin(), r.coil_steps.end(), std::make_pair(coil, uint16_t(0)));
+      for (; it != r.coil_steps.end() && it->first == coil; ++it) {
+        r.decode_plan[it->second].item->parse_and_publish(data);
+      }
+    }
+  }
+}
+
+/// a write single/multiple register or coil command with a payload matching its count
+static bool is_coalescable_write(const ModbusCommandItem &command) {
+  if (command.range_index >= 0) {
+    return false;
+  }
+  switch (command.function_code) {
+    case ModbusFunctionCode::WRITE_SINGLE_REGISTER:
+    case ModbusFunctionCode::WRITE_SINGLE_COIL:
+      return command.payload.size() == 2;
+    case ModbusFunctionCode::WRITE_MULTIPLE_REGISTERS:
+      return command.payload.size() == command.register_count * 2u;
+    case ModbusFunctionCode::WRITE_MULTIPLE_COILS:
+      return command.payload.size() == (command.register_count + 7u) / 8u;
+    default:
+      return false;
+  }
+}
+
+/// copy the coil values of a write coil command into a bitmap starting at start_address
+static void apply_coil_write(std::vector<uint8_t> &bits, uint16_t start_address, const ModbusCommandItem &command) {
+  for (uint16_t i = 0; i < command.register_count; i++) {
+    bool value = command.function_code == ModbusFunctionCode::WRITE_SINGLE_COIL
+                     ? command.payload[0] == 0xFF
+                     : (command.payload[i / 8] & (1 << (i % 8))) != 0;
+    uint16_t coil = command.register_address - start_address + i;
+    if (value) {
+      bits[coil / 8] |= 1 << (coil % 8);
+    } else {
+      bits[coil / 8] &= ~(1 << (coil % 8));
+    }
+  }
+}
+
+bool ModbusTCPController::coalesce_write_(const ModbusCommandItem &command) {
+  /* Only the last queued write is a candidate: merging into an older one would send this write ahead of the
+   * writes queued in between. A bulk change of neighbouring setpoints is queued in a row and becomes one request.
+   */
+  const auto &queue = this->command_queues_[uint8_t(CommandPriority::WRITE)];
+  if (queue.empty() || !is_coalescable_write(command)) {
+    return false;
+  }
+  uint8_t slot = queue.at(queue.size() - 1);
+  auto &queued = this->command_slots_[slot].command;
+  if (!is_coalescable_write(queued) || queued.register_type != command.register_type) {
+    return false;
+  }
+  uint32_t queued_end = uint32_t(queued.register_address) + queued.register_count;
+  uint32_t command_end = uint32_t(command.register_address) + command.register_count;
+  if (command.register_address > queued_end || queued.register_address > command_end) {
+    return false;
+  }
+  uint16_t start = std::min(queued.register_address, command.register_address);
+  uint16_t count = std::max(queued_end, command_end) - start;
+  bool coils = command.register_type == ModbusRegisterType::COIL;
+  if (count > (coils ? modbustcp::MAX_NUM_OF_COILS_TO_WRITE : this->max_registers_per_write_)) {
+    return false;
+  }
+  ESP_LOGV(TAG, "Coalesce write 0x%X %u into 0x%X %u", command.register_address, command.register_count,
+           queued.register_address, queued.register_count);
+  // the key depends on address and count
+  this->index_remove_(slot);
+  // the merged payload is built in the queued one, it stays within the capacity reserved for the slot
+  uint16_t shift = queued.register_address - start;
+  if (count == 1) {
+    // same address, keep the single write
+    queued.function_code = command.function_code;
+    queued.payload.assign(command.payload.begin(), command.payload.end());
+  } else if (coils) {
+    size_t bytes = (count + 7) / 8;
+    if (queued.function_code == ModbusFunctionCode::WRITE_SINGLE_COIL) {
+      bool value = queued.payload[0] == 0xFF;
+      queued.payload.assign(bytes, 0);
+      queued.payload[shift / 8] |= value << (shift % 8);
+    } else {
+      // move the queued coils up by shift, from the top so no coil is overwritten before it was moved
+      queued.payload.resize(bytes, 0);
+      auto &bits = queued.payload;
+      for (uint16_t i = queued.register_count; i-- > 0;) {
+        uint16_t to = i + shift;
+        if (bits[i / 8] & (1 << (i % 8))) {
+          bits[to / 8] |= 1 << (to % 8);
+        } else {
+          bits[to / 8] &= ~(1 << (to % 8));
+        }
+      }
+      for (uint16_t i = 0; i < shift; i++) {
+        bits[i / 8] &= ~(1 << (i % 8));
+      }
+      if (count % 8 != 0) {
+        // the padding of the old last byte may now be past the end
+        bits[bytes - 1] &= (1 << (count % 8)) - 1;
+      }
+    }
+    // last write wins
+    apply_coil_write(queued.payload, start, command);
+    queued.function_code = ModbusFunctionCode::WRITE_MULTIPLE_COILS;
+  } else {
+    queued.payload.insert(queued.payload.begin(), shift * 2, 0);
+    queued.payload.resize(count * 2, 0);
+    std::copy(command.payload.begin(), command.payload.end(),
+              queued.payload.begin() + (command.register_address - start) * 2);
+    queued.function_code = ModbusFunctionCode::WRITE_MULTIPLE_REGISTERS;
+  }
+  queued.register_address = start;
+  queued.register_count = count;
+  this->index_add_(slot);
+  return true;
 }
 
 void ModbusTCPController::queue_command(const ModbusCommandItem &command) {
+  if (command.function_code == ModbusFunctionCode::WRITE_MULTIPLE_REGISTERS &&
+      command.register_count > this->max_registers_per_write_ && command.payload.size() == command.register_count * 2u) {
+    // the device doesn't accept writes this large - send it in chunks
+    for (uint16_t done = 0; done < command.register_count; done += this->max_registers_per_write_) {
+      ModbusCommandItem chunk = command;
+      chunk.register_address = command.register_address + done;
+      chunk.register_count = std::min<uint16_t>(this->max_registers_per_write_, command.register_count - done);
+      chunk.payload.assign(command.payload.begin() + done * 2,
+                           command.payload.begin() + (done + chunk.register_count) * 2);
+      this->queue_command(chunk);
+    }
+    return;
+  }
+  if (this->skip_unchanged_ && command.priority == CommandPriority::WRITE) {
+    // a switch publishes its new state before the device confirms it, the next polls have to publish again
+    for (auto &r : this->register_ranges_) {
+      r.last_data.clear();
+    }
+  }
   if (!this->allow_duplicate_commands_) {
     // check if this command is already qeued.
-    // not very effective but the queue is never really large
-    for (auto &item : this->command_queue_) {
-      if (item->is_equal(command)) {
-        ESP_LOGW(TAG, "Duplicate modbus command found: type=0x%x address=%u count=%u",
+    uint8_t queued = this->find_queued_(command, command.dedup_key());
+    if (queued != NO_COMMAND_SLOT) {
+      ESP_LOGW(TAG, "Duplicate modbus command found: type=0x%x address=%u count=%u",
+               static_cast<uint8_t>(command.register_type), command.register_address, command.register_count);
+      // update the payload of the queued command
+      // replaces a previous command
+      auto &queued_command = this->command_slots_[queued].command;
+      if (command.function_code == ModbusFunctionCode::MASK_WRITE_REGISTER && command.payload.size() == 4 &&
+          queued_command.payload.size() == 4) {
+        // bit changes of the same register are batched into one mask write
+        uint16_t and_1 = get_data<uint16_t>(queued_command.payload, 0);
+        uint16_t or_1 = get_data<uint16_t>(queued_command.payload, 2);
+        uint16_t and_2 = get_data<uint16_t>(command.payload, 0);
+        uint16_t or_2 = get_data<uint16_t>(command.payload, 2);
+        auto decoded_and = decode_value(and_1 & and_2);
+        auto decoded_or = decode_value((or_1 & ~and_1 & and_2) | (or_2 & ~and_2));
+        queued_command.payload = {decoded_and[0], decoded_and[1], decoded_or[0], decoded_or[1]};
+      } else {
+        queued_command.payload = command.payload;
+      }
+      if (command.priority < queued_command.priority) {
+        // e.g. an on-demand read of a range that waits for its poll - move it ahead
+        this->command_queues_[uint8_t(queued_command.priority)].remove_if(
+            [queued](uint8_t slot) { return slot == queued; });
+        queued_command.priority = command.priority;
+        this->command_queues_[uint8_t(command.priority)].push_back(queued);
+      }
+      return;
+    }
+    // an identical command is already on its way to the device. At most max_outstanding entries
+    for (uint8_t slot : this->inflight_) {
+      const auto &item = this->command_slots_[slot].command;
+      if (item.is_equal(command) && item.payload == command.payload) {
+        ESP_LOGW(TAG, "Duplicate modbus command in flight: type=0x%x address=%u count=%u",
                  static_cast<uint8_t>(command.register_type), command.register_address, command.register_count);
-        // update the payload of the queued command
-        // replaces a previous command
-        item->payload = command.payload;
         return;
       }
     }
   }
-  this->command_queue_.push_back(make_unique<ModbusCommandItem>(command));
+  if (this->coalesce_writes_ && this->coalesce_write_(command)) {
+    return;
+  }
+  uint8_t slot = this->alloc_slot_();
+  if (slot == NO_COMMAND_SLOT) {
+    ESP_LOGW(TAG, "Command queue full (%u commands) - command type=0x%x address=%u dropped",
+             static_cast<unsigned>(this->command_slots_.size()), static_cast<uint8_t>(command.register_type),
+             command.register_address);
+    return;
+  }
+  // copy assignment reuses the payload capacity of the slot
+  this->command_slots_[slot].command = command;
+  this->enqueue_slot_(slot, false);
 }
 
-void ModbusTCPController::update_range_(RegisterRange &r) {
+void ModbusTCPController::update_range_(size_t range_index) {
+  auto &r = this->register_ranges_[range_index];
   ESP_LOGV(TAG, "Range : %X Size: %x (%d) skip: %d", r.start_address, r.register_count, (int) r.register_type,
            r.skip_updates_counter);
+  if (r.disabled) {
+    return;
+  }
   if (r.skip_updates_counter == 0) {
-    // if a custom command is used the user supplied custom_data is only available in the SensorItem.
-    if (r.register_type == ModbusRegisterType::CUSTOM) {
-      auto sensors = this->find_sensors_(r.register_type, r.start_address);
-      if (!sensors.empty()) {
-        auto sensor = sensors.cbegin();
-        auto command_item = ModbusCommandItem::create_custom_command(
-            this, (*sensor)->custom_data,
-            [this](ModbusRegisterType register_type, uint16_t start_address, const std::vector<uint8_t> &data) {
-              this->on_register_data(ModbusRegisterType::CUSTOM, start_address, data);
-            });
-        command_item.register_address = (*sensor)->start_address;
-        command_item.register_count = (*sensor)->register_count;
-        command_item.function_code = ModbusFunctionCode::CUSTOM;
-        queue_command(command_item);
-      }
-    } else {
-      queue_command(ModbusCommandItem::create_read_command(this, r.register_type, r.start_address, r.register_count));
-    }
+    queue_command(ModbusCommandItem::create_range_read_command(this, range_index));
     r.skip_updates_counter = r.skip_updates;  // reset counter to config value
   } else {
     r.skip_updates_counter--;
   }
 }
+
+void ModbusTCPController::request_update(SensorItem *item) {
+  for (size_t i = 0; i < this->register_ranges_.size(); i++) {
+    const auto &r = this->register_ranges_[i];
+    if (std::find(r.sensors.begin(), r.sensors.end(), item) == r.sensors.end()) {
+      continue;
+    }
+    if (!r.disabled) {
+      auto cmd = ModbusCommandItem::create_range_read_command(this, i);
+      cmd.priority = CommandPriority::ON_DEMAND;
+      this->queue_command(cmd);
+    }
+    return;
+  }
+  ESP_LOGW(TAG, "No range found for sensor at 0x%X", item->start_address);
+}
+
+uint16_t ModbusTCPController::send_range_request(size_t range_index) {
+  if (range_index >= this->register_ranges_.size()) {
+    return 0;
+  }
+  auto &frame = this->register_ranges_[range_index].request_frame;
+  return this->send_frame(frame.data(), frame.size());
+}
+
+// A separate request costs a full round-trip plus ~20 bytes of headers, reading a few unused registers only costs
+// their bytes in the response. Bridge a gap if its response bytes don't exceed max_gap registers (a byte holds 8
+// coils) and the merged range stays within the read limit of the function code and max_registers_per_read.
+bool ModbusTCPController::can_extend_range_(const RegisterRange &r, const SensorItem *item,
+                                            uint16_t buffer_offset) const {
+  uint32_t range_end = uint32_t(r.start_address) + r.register_count;
+  if (item->start_address < range_end) {
+    return false;
+  }
+  uint32_t gap = item->start_address - range_end;
+  bool bits = r.register_type == ModbusRegisterType::COIL || r.register_type == ModbusRegisterType::DISCRETE_INPUT;
+  uint32_t gap_bytes = bits ? (gap + 7) / 8 : gap * 2;
+  if (gap_bytes > uint32_t(this->max_gap_) * 2) {
+    return false;
+  }
+  uint32_t register_count = r.register_count + gap + item->register_count;
+  if (bits) {
+    return register_count <= modbustcp::MAX_NUM_OF_COILS_TO_READ;
+  }
+  // response_bytes can make a sensor larger than its registers - the response must still fit into one frame
+  uint32_t response_bytes = buffer_offset + gap * 2 + item->get_register_size();
+  return register_count <= this->max_registers_per_read_ && response_bytes <= this->max_registers_per_read_ * 2u;
+}
+
+void ModbusTCPController::build_range_frame_(RegisterRange &r) {
+  uint8_t buffer[modbustcp::MBAP_MAX_ADU_SIZE];
+  size_t len;
+  if (r.register_type == ModbusRegisterType::CUSTOM) {
+    // if a custom command is used the user supplied custom_data is only available in the SensorItem.
+    const auto &custom_data = r.sensors.front()->custom_data;
+    len = modbustcp::encode_raw(buffer, sizeof(buffer), 0, custom_data.data(), custom_data.size());
+  } else {
+    len = modbustcp::encode_request(buffer, sizeof(buffer), 0, this->address_,
+                                    uint8_t(modbus_register_read_function(r.register_type)), r.start_address,
+                                    r.register_count);
+  }
+  if (len == 0) {
+    ESP_LOGE(TAG, "Can't encode request for range 0x%X", r.start_address);
+  }
+  r.request_frame.assign(buffer, buffer + len);
+}
+
+void ModbusTCPController::build_decode_plan_(RegisterRange &r) {
+  bool bits = r.register_type == ModbusRegisterType::COIL || r.register_type == ModbusRegisterType::DISCRETE_INPUT;
+  r.decode_plan.clear();
+  r.decode_plan.reserve(r.sensors.size());
+  r.coil_steps.clear();
+  for (auto *item : r.sensors) {
+    DecodeStep step{nullptr, item, item->bitmask, item->offset, 0, 0, false, false};
+    if (item->decodes_number()) {
+      step.decode = value_decoder(item->sensor_value_type, step.size);
+      step.own_bytes = step.decode != nullptr && item->depends_on_own_bytes();
+    } else if (item->depends_on_own_bytes()) {
+      // binary sensors and switches read one coil or one register
+      if (bits) {
+        step.own_bit = true;
+      } else {
+        step.size = 2;
+        step.own_bytes = true;
+      }
+    }
+    if (step.mask != 0xFFFFFFFF && step.mask != 0) {
+      step.shift = __builtin_ctz(step.mask);
+      uint8_t bits = step.size == 2 ? 16 : 32;
+      if (step.shift >= bits) {
+        // no bit of the mask inside the value
+        step.mask = 0;
+        step.shift = 0;
+      }
+    }
+    if (step.own_bit) {
+      r.coil_steps.emplace_back(step.offset, r.decode_plan.size());
+    }
+    r.decode_plan.push_back(step);
+  }
+  std::sort(r.coil_steps.begin(), r.coil_steps.end());
+  if (this->decoded_values_.size() < r.decode_plan.size()) {
+    this->decoded_values_.resize(r.decode_plan.size());
+    this->unchanged_steps_.resize(r.decode_plan.size());
+  }
+}
+
 //
 // Queue the modbus requests to be send.
 // Once we get a response to the command it is removed from the queue and the next command is send
 //
 void ModbusTCPController::update() {
-  if (!this->command_queue_.empty()) {
-    ESP_LOGV(TAG, "%zu modbus commands already in queue", this->command_queue_.size());
+  if (this->probe_max_registers_ && !this->probe_done_) {
+    // regular polling starts once the probe is finished
+    if (!this->probing_) {
+      this->start_probe_();
+    }
+    return;
+  }
+  if (this->queued_commands_() > 0) {
+    ESP_LOGV(TAG, "%zu modbus commands already in queue", this->queued_commands_());
   } else {
     ESP_LOGV(TAG, "Updating modbus component");
   }
+  if (this->queue_depth_samples_ > 0) {
+    this->last_queue_depth_max_ = this->queue_depth_max_;
+    this->last_queue_depth_avg_ = float(this->queue_depth_sum_) / this->queue_depth_samples_;
+    ESP_LOGD(TAG, "Queue depth of the last update interval: avg %.1f max %u", this->last_queue_depth_avg_,
+             this->last_queue_depth_max_);
+    ESP_LOGD(TAG, "Requests sent: %u responses: %u timeouts: %u", this->requests_sent_, this->responses_received_,
+             this->timeouts_);
+    this->queue_depth_max_ = 0;
+    this->queue_depth_sum_ = 0;
+    this->queue_depth_samples_ = 0;
+  }
+
+  uint32_t period = this->get_update_interval();
+  if (this->stagger_polls_ && period != 0 && period != SCHEDULER_DONT_RUN) {
+    this->stagger_range_polls_();
+    return;
+  }
+  for (size_t i = 0; i < this->register_ranges_.size(); i++) {
+    if (this->register_ranges_[i].update_interval != 0) {
+      // polled by poll_due_ranges_()
+      continue;
+    }
+    ESP_LOGVV(TAG, "Updating range 0x%X", this->register_ranges_[i].start_address);
+    update_range_(i);
+  }
+}
+
+/*
+  Sensors with their own update_interval get ranges of their own. These ranges are kept in a min-heap on their next
+  deadline, loop() pops and queues every range that is due, earliest deadline first. The next deadline is one
+  interval later; a range that fell behind (slow device, long queue) continues from now instead of catching up
+  with a burst of reads.
+*/
+void ModbusTCPController::poll_due_ranges_() {
+  const uint32_t now = millis();
+  while (!this->poll_schedule_.empty() && int32_t(now - this->poll_schedule_.front().due) >= 0) {
+    std::pop_heap(this->poll_schedule_.begin(), this->poll_schedule_.end(), due_later);
+    auto &next = this->poll_schedule_.back();
+    this->update_range_(next.range_index);
+    uint32_t interval = this->register_ranges_[next.range_index].update_interval;
+    if (interval == 0) {
+      // a staggered poll of update()
+      this->poll_schedule_.pop_back();
+      continue;
+    }
+    next.due += interval;
+    if (int32_t(now - next.due) >= 0) {
+      next.due = now + interval;
+    }
+    std::push_heap(this->poll_schedule_.begin(), this->poll_schedule_.end(), due_later);
+  }
+}
 
+/*
+  Without staggering update() queues every range at once, and all controllers on a connection fire on the same
+  tick. With stagger_polls the ranges polled by update() get evenly spaced deadlines across the update interval:
+  range j of n is due after j * interval / n. Controller k of K on the connection is shifted by k/K of that
+  spacing, so the polls of all controllers interleave. poll_jitter shifts each deadline by a random amount.
+*/
+void ModbusTCPController::stagger_range_polls_() {
+  const uint32_t now = millis();
+  // polls of the last cycle still waiting for their deadline go out now
+  size_t kept = 0;
+  for (auto &entry : this->poll_schedule_) {
+    if (this->register_ranges_[entry.range_index].update_interval == 0) {
+      this->update_range_(entry.range_index);
+    } else {
+      this->poll_schedule_[kept++] = entry;
+    }
+  }
+  this->poll_schedule_.resize(kept);
+
+  size_t count = 0;
   for (auto &r : this->register_ranges_) {
-    ESP_LOGVV(TAG, "Updating range 0x%X", r.start_address);
-    update_range_(r);
+    count += r.update_interval == 0;
+  }
+  if (count == 0) {
+    std::make_heap(this->poll_schedule_.begin(), this->poll_schedule_.end(), due_later);
+    return;
+  }
+  const uint32_t period = this->get_update_interval();
+  const uint32_t spacing = period / count;
+  const size_t devices = std::max<size_t>(this->parent_->get_device_count(), 1);
+  const uint32_t phase = spacing * this->parent_->get_device_position(this) / devices;
+  size_t j = 0;
+  for (size_t i = 0; i < this->register_ranges_.size(); i++) {
+    if (this->register_ranges_[i].update_interval != 0) {
+      continue;
+    }
+    int64_t offset = phase + int64_t(spacing) * j++;
+    if (this->poll_jitter_ > 0) {
+      offset += int64_t(random_uint32() % (2 * this->poll_jitter_ + 1)) - this->poll_jitter_;
+    }
+    offset = std::max<int64_t>(0, std::min<int64_t>(offset, period - 1));
+    this->poll_schedule_.push_back({now + uint32_t(offset), static_cast<uint16_t>(i)});
+  }
+  std::make_heap(this->poll_schedule_.begin(), this->poll_schedule_.end(), due_later);
+}
+
+void ModbusTCPController::sample_queue_depth_() {
+  uint8_t depth = this->queued_commands_();
+  this->queue_depth_max_ = std::max(this->queue_depth_max_, depth);
+  this->queue_depth_sum_ += depth;
+  this->queue_depth_samples_++;
+}
+
+void ModbusTCPController::schedule_ranges_() {
+  this->poll_schedule_.clear();
+  this->poll_schedule_.reserve(this->register_ranges_.size());
+  const uint32_t now = millis();
+  for (size_t i = 0; i < this->register_ranges_.size(); i++) {
+    if (this->register_ranges_[i].update_interval != 0) {
+      this->poll_schedule_.push_back({now, static_cast<uint16_t>(i)});
+    }
   }
+  std::make_heap(this->poll_schedule_.begin(), this->poll_schedule_.end(), due_later);
 }
 
 // walk through the sensors and determine the register ranges to read
@@ -329,10 +1283,23 @@ size_t ModbusTCPController::create_register_ranges_() {
     return 0;
   }
 
+  // start again from the configured addresses - a previous plan changed them (and with them the sort order)
+  std::vector<SensorItem *> items(this->sensorset_.begin(), this->sensorset_.end());
+  this->sensorset_.clear();
+  for (auto *item : items) {
+    item->start_address = item->configured_address;
+    item->offset = item->configured_offset;
+    if (item->update_interval == this->get_update_interval()) {
+      // same rate as update(), no need for separate ranges
+      item->update_interval = 0;
+    }
+    this->sensorset_.insert(item);
+  }
+
   // iterator is sorted see SensorItemsComparator for details
   auto ix = this->sensorset_.begin();
   RegisterRange r = {};
-  uint8_t buffer_offset = 0;
+  uint16_t buffer_offset = 0;
   SensorItem *prev = nullptr;
   while (ix != this->sensorset_.end()) {
     SensorItem *curr = *ix;
@@ -345,17 +1312,21 @@ size_t ModbusTCPController::create_register_ranges_() {
       r.start_address = curr->start_address;
       r.register_count = curr->register_count;
       r.register_type = curr->register_type;
-      r.sensors.insert(curr);
       r.skip_updates = curr->skip_updates;
       r.skip_updates_counter = 0;
+      r.disabled = this->has_learned_entry_(curr->register_type, curr->start_address, LEARNED_HOLE);
+      r.priority = curr->low_priority ? CommandPriority::LOW : CommandPriority::POLL;
+      r.update_interval = curr->update_interval;
       buffer_offset = curr->get_register_size();
 
       ESP_LOGV(TAG, "Started new range");
     } else {
       // this is not the first register in range so it might be possible
       // to reuse the last register or extend the current range
-      if (!curr->force_new_range && r.register_type == curr->register_type &&
-          curr->register_type != ModbusRegisterType::CUSTOM) {
+      bool learned_split = this->has_learned_entry_(curr->register_type, curr->start_address, LEARNED_SPLIT) ||
+                           this->has_learned_entry_(curr->register_type, curr->start_address, LEARNED_HOLE);
+      if (!curr->force_new_range && !learned_split && r.register_type == curr->register_type &&
+          r.update_interval == curr->update_interval && curr->register_type != ModbusRegisterType::CUSTOM) {
         if (curr->start_address == (r.start_address + r.register_count - prev->register_count) &&
             curr->register_count == prev->register_count && curr->get_register_size() == prev->get_register_size()) {
           // this register can re-use the data from the previous register
@@ -372,8 +1343,12 @@ size_t ModbusTCPController::create_register_ranges_() {
 
           ESP_LOGV(TAG, "Re-use previous register - change to register: 0x%X %d offset=%u", curr->start_address,
                    curr->register_count, curr->offset);
-        } else if (curr->start_address == (r.start_address + r.register_count)) {
-          // this register can extend the current range
+        } else if (!r.disabled && this->can_extend_range_(r, curr, buffer_offset)) {
+          // this register can extend the current range, unused registers in between are read as well
+          uint16_t gap = curr->start_address - (r.start_address + r.register_count);
+          bool bits = r.register_type == ModbusRegisterType::COIL ||
+                      r.register_type == ModbusRegisterType::DISCRETE_INPUT;
+          buffer_offset += bits ? gap : gap * 2;
 
           // remove this sensore because start_address is changed (sort-order)
           ix = this->sensorset_.erase(ix);
@@ -381,7 +1356,7 @@ size_t ModbusTCPController::create_register_ranges_() {
           curr->start_address = r.start_address;
           curr->offset += buffer_offset;
           buffer_offset += curr->get_register_size();
-          r.register_count += curr->register_count;
+          r.register_count += gap + curr->register_count;
 
           this->sensorset_.insert(curr);
           // move iterator backwards because it will be incremented later
@@ -393,7 +1368,8 @@ size_t ModbusTCPController::create_register_ranges_() {
       }
     }
 
-    if (curr->start_address == r.start_address && curr->register_type == r.register_type) {
+    if (curr->start_address == r.start_address && curr->register_type == r.register_type &&
+        curr->update_interval == r.update_interval) {
       // use the lowest non zero value for the whole range
       // Because zero is the default value for skip_updates it is excluded from getting the min value.
       if (curr->skip_updates != 0) {
@@ -404,8 +1380,11 @@ size_t ModbusTCPController::create_register_ranges_() {
         }
       }
 
-      // add sensor to this range
-      r.sensors.insert(curr);
+      if (!curr->low_priority) {
+        r.priority = CommandPriority::POLL;
+      }
+      // add sensor to this range, the sensors are visited in sort order
+      r.sensors.push_back(curr);
 
       ix++;
     } else {
@@ -425,6 +1404,12 @@ size_t ModbusTCPController::create_register_ranges_() {
     this->register_ranges_.push_back(r);
   }
 
+  for (auto &range : this->register_ranges_) {
+    this->build_range_frame_(range);
+    this->build_decode_plan_(range);
+  }
+  this->schedule_ranges_();
+
   return this->register_ranges_.size();
 }
 
@@ -433,8 +1418,16 @@ void ModbusTCPController::dump_config() {
                 "ModbusTCPController:\n"
                 "  Address: 0x%02X\n"
                 "  Max Command Retries: %d\n"
-                "  Offline Skip Updates: %d",
-                this->address_, this->max_cmd_retries_, this->offline_skip_updates_);
+                "  Offline Skip Updates: %d\n"
+                "  Max Gap: %u\n"
+                "  Max Registers Per Read/Write: %u/%u\n"
+                "  Command Slots: %u\n"
+                "  Coalesce Writes: %s\n"
+                "  Loop Budget: %u us",
+                this->address_, this->max_cmd_retries_, this->offline_skip_updates_, this->max_gap_,
+                this->max_registers_per_read_, this->max_registers_per_write_,
+                static_cast<unsigned>(this->command_slots_.size()), YESNO(this->coalesce_writes_),
+                this->loop_budget_us_);
 #if ESPHOME_LOG_LEVEL >= ESPHOME_LOG_LEVEL_VERBOSE
   ESP_LOGCONFIG(TAG, "sensormap");
   for (auto &it : this->sensorset_) {
@@ -444,8 +1437,9 @@ void ModbusTCPController::dump_config() {
   }
   ESP_LOGCONFIG(TAG, "ranges");
   for (auto &it : this->register_ranges_) {
-    ESP_LOGCONFIG(TAG, "  Range type=%zu start=0x%X count=%d skip_updates=%d", static_cast<uint8_t>(it.register_type),
-                  it.start_address, it.register_count, it.skip_updates);
+    ESP_LOGCONFIG(TAG, "  Range type=%u start=0x%X count=%d skip_updates=%d update_interval=%ums",
+                  (unsigned) it.register_type, it.start_address, it.register_count, it.skip_updates,
+                  it.update_interval);
   }
   ESP_LOGCONFIG(TAG, "server registers");
   for (auto &r : this->server_registers_) {
@@ -456,17 +1450,27 @@ void ModbusTCPController::dump_config() {
 }
 
 void ModbusTCPController::loop() {
-  // Incoming data to process?
-  if (!this->incoming_queue_.empty()) {
-    auto &message = this->incoming_queue_.front();
-    if (message != nullptr)
-      this->process_modbus_data_(message.get());
-    this->incoming_queue_.pop();
-
-  } else {
-    // all messages processed send pending commands
-    this->send_next_command_();
+  if (this->replan_pending_) {
+    this->replan_ranges_();
+  }
+  if (!this->poll_schedule_.empty() && (!this->probe_max_registers_ || this->probe_done_)) {
+    this->poll_due_ranges_();
   }
+  // Process all queued responses within the loop budget
+  const uint32_t start = micros();
+  while (!this->incoming_queue_.empty()) {
+    uint8_t slot = this->incoming_queue_.front();
+    this->incoming_queue_.pop_front();
+    this->process_modbus_data_(&this->command_slots_[slot].command);
+    this->release_slot_(slot);
+    if (micros() - start >= this->loop_budget_us_) {
+      break;
+    }
+  }
+  // send pending commands right away instead of waiting for the next loop iteration. The transport decides
+  // which of the devices on the connection sends next
+  this->parent_->send_pending();
+  this->sample_queue_depth_();
 }
 
 void ModbusTCPController::on_write_register_response(ModbusRegisterType register_type, uint16_t start_address,
@@ -512,6 +1516,25 @@ ModbusCommandItem ModbusCommandItem::create_read_command(ModbusTCPController *mo
   return cmd;
 }
 
+ModbusCommandItem ModbusCommandItem::create_range_read_command(ModbusTCPController *modbusdevice,
+                                                               size_t range_index) {
+  const auto &r = modbusdevice->get_register_ranges()[range_index];
+  ModbusCommandItem cmd;
+  cmd.modbusdevice = modbusdevice;
+  cmd.register_type = r.register_type;
+  cmd.function_code = modbus_register_read_function(r.register_type);
+  cmd.register_address = r.start_address;
+  cmd.register_count = r.register_count;
+  cmd.range_index = range_index;
+  cmd.priority = r.priority;
+  if (r.register_type == ModbusRegisterType::CUSTOM) {
+    auto *sensor = r.sensors.front();
+    cmd.register_address = sensor->start_address;
+    cmd.register_count = sensor->register_count;
+  }
+  return cmd;
+}
+
 ModbusCommandItem ModbusCommandItem::create_write_multiple_command(ModbusTCPController *modbusdevice,
                                                                    uint16_t start_address, uint16_t register_count,
                                                                    const std::vector<uint16_t> &values) {
@@ -519,12 +1542,14 @@ ModbusCommandItem ModbusCommandItem::create_write_multiple_command(ModbusTCPCont
   cmd.modbusdevice = modbusdevice;
   cmd.register_type = ModbusRegisterType::HOLDING;
   cmd.function_code = ModbusFunctionCode::WRITE_MULTIPLE_REGISTERS;
+  cmd.priority = CommandPriority::WRITE;
   cmd.register_address = start_address;
   cmd.register_count = register_count;
-  cmd.on_data_func = [modbusdevice, cmd](ModbusRegisterType register_type, uint16_t start_address,
-                                         const std::vector<uint8_t> &data) {
-    modbusdevice->on_write_register_response(cmd.register_type, start_address, data);
+  cmd.on_data_func = [modbusdevice](ModbusRegisterType register_type, uint16_t start_address,
+                                    const std::vector<uint8_t> &data) {
+    modbusdevice->on_write_register_response(register_type, start_address, data);
   };
+  cmd.payload.reserve(values.size() * 2);
   for (auto v : values) {
     auto decoded_value = decode_value(v);
     cmd.payload.push_back(decoded_value[0]);
@@ -539,14 +1564,14 @@ ModbusCommandItem ModbusCommandItem::create_write_single_coil(ModbusTCPControlle
   cmd.modbusdevice = modbusdevice;
   cmd.register_type = ModbusRegisterType::COIL;
   cmd.function_code = ModbusFunctionCode::WRITE_SINGLE_COIL;
+  cmd.priority = CommandPriority::WRITE;
   cmd.register_address = address;
   cmd.register_count = 1;
-  cmd.on_data_func = [modbusdevice, cmd](ModbusRegisterType register_type, uint16_t start_address,
-                                         const std::vector<uint8_t> &data) {
-    modbusdevice->on_write_register_response(cmd.register_type, start_address, data);
+  cmd.on_data_func = [modbusdevice](ModbusRegisterType register_type, uint16_t start_address,
+                                    const std::vector<uint8_t> &data) {
+    modbusdevice->on_write_register_response(register_type, start_address, data);
   };
-  cmd.payload.push_back(value ? 0xFF : 0);
-  cmd.payload.push_back(0);
+  cmd.payload = {static_cast<uint8_t>(value ? 0xFF : 0), 0};
   return cmd;
 }
 
@@ -556,13 +1581,15 @@ ModbusCommandItem ModbusCommandItem::create_write_multiple_coils(ModbusTCPContro
   cmd.modbusdevice = modbusdevice;
   cmd.register_type = ModbusRegisterType::COIL;
   cmd.function_code = ModbusFunctionCode::WRITE_MULTIPLE_COILS;
+  cmd.priority = CommandPriority::WRITE;
   cmd.register_address = start_address;
   cmd.register_count = values.size();
-  cmd.on_data_func = [modbusdevice, cmd](ModbusRegisterType register_type, uint16_t start_address,
-                                         const std::vector<uint8_t> &data) {
-    modbusdevice->on_write_register_response(cmd.register_type, start_address, data);
+  cmd.on_data_func = [modbusdevice](ModbusRegisterType register_type, uint16_t start_address,
+                                    const std::vector<uint8_t> &data) {
+    modbusdevice->on_write_register_response(register_type, start_address, data);
   };
 
+  cmd.payload.reserve((values.size() + 7) / 8);
   uint8_t bitmask = 0;
   int bitcounter = 0;
   for (auto coil : values) {
@@ -588,16 +1615,90 @@ ModbusCommandItem ModbusCommandItem::create_write_single_command(ModbusTCPContro
   cmd.modbusdevice = modbusdevice;
   cmd.register_type = ModbusRegisterType::HOLDING;
   cmd.function_code = ModbusFunctionCode::WRITE_SINGLE_REGISTER;
+  cmd.priority = CommandPriority::WRITE;
   cmd.register_address = start_address;
   cmd.register_count = 1;  // not used here anyways
-  cmd.on_data_func = [modbusdevice, cmd](ModbusRegisterType register_type, uint16_t start_address,
-                                         const std::vector<uint8_t> &data) {
-    modbusdevice->on_write_register_response(cmd.register_type, start_address, data);
+  cmd.on_data_func = [modbusdevice](ModbusRegisterType register_type, uint16_t start_address,
+                                    const std::vector<uint8_t> &data) {
+    modbusdevice->on_write_register_response(register_type, start_address, data);
   };
 
   auto decoded_value = decode_value(value);
-  cmd.payload.push_back(decoded_value[0]);
-  cmd.payload.push_back(decoded_value[1]);
+  cmd.payload = {decoded_value[0], decoded_value[1]};
+  return cmd;
+}
+
+ModbusCommandItem ModbusCommandItem::create_read_write_command(ModbusTCPController *modbusdevice,
+                                                               uint16_t start_address,
+                                                               const std::vector<uint16_t> &values) {
+  size_t max_values = std::min<size_t>(modbustcp::MAX_NUM_OF_REGISTERS_TO_READ_WRITE,
+                                       modbusdevice->get_max_registers_per_write());
+  if (values.empty() || values.size() > max_values) {
+    if (!values.empty()) {
+      ESP_LOGE(TAG, "Read/write of %u registers at 0x%X exceeds the limit of %u, sent as write multiple registers",
+               (unsigned) values.size(), start_address, (unsigned) max_values);
+    }
+    return create_write_multiple_command(modbusdevice, start_address, values.size(), values);
+  }
+  ModbusCommandItem cmd;
+  cmd.modbusdevice = modbusdevice;
+  cmd.register_type = ModbusRegisterType::HOLDING;
+  cmd.function_code = ModbusFunctionCode::READ_WRITE_MULTIPLE_REGISTERS;
+  cmd.priority = CommandPriority::WRITE;
+  // the read part: the range containing the written registers
+  cmd.register_address = start_address;
+  cmd.register_count = values.size();
+  bool range = false;
+  for (const auto &r : modbusdevice->get_register_ranges()) {
+    if (r.register_type == ModbusRegisterType::HOLDING && !r.disabled && r.start_address <= start_address &&
+        start_address + values.size() <= uint32_t(r.start_address) + r.register_count) {
+      cmd.register_address = r.start_address;
+      cmd.register_count = r.register_count;
+      range = true;
+      break;
+    }
+  }
+  if (range) {
+    cmd.on_data_func = [modbusdevice](ModbusRegisterType register_type, uint16_t start_address,
+                                      const std::vector<uint8_t> &data) {
+      modbusdevice->on_register_data(register_type, start_address, data);
+    };
+  } else {
+    cmd.on_data_func = [modbusdevice](ModbusRegisterType register_type, uint16_t start_address,
+                                      const std::vector<uint8_t> &data) {
+      modbusdevice->on_write_register_response(register_type, start_address, data);
+    };
+  }
+  // the write part follows the read address and quantity: address, quantity, byte count and the values
+  cmd.payload.reserve(5 + values.size() * 2);
+  auto decoded_address = decode_value(start_address);
+  auto decoded_count = decode_value(values.size());
+  cmd.payload = {decoded_address[0], decoded_address[1], decoded_count[0], decoded_count[1],
+                 static_cast<uint8_t>(values.size() * 2)};
+  for (auto v : values) {
+    auto decoded_value = decode_value(v);
+    cmd.payload.push_back(decoded_value[0]);
+    cmd.payload.push_back(decoded_value[1]);
+  }
+  return cmd;
+}
+
+ModbusCommandItem ModbusCommandItem::create_mask_write_command(ModbusTCPController *modbusdevice, uint16_t address,
+                                                               uint16_t and_mask, uint16_t or_mask) {
+  ModbusCommandItem cmd;
+  cmd.modbusdevice = modbusdevice;
+  cmd.register_type = ModbusRegisterType::HOLDING;
+  cmd.function_code = ModbusFunctionCode::MASK_WRITE_REGISTER;
+  cmd.priority = CommandPriority::WRITE;
+  cmd.register_address = address;
+  cmd.register_count = 1;
+  cmd.on_data_func = [modbusdevice](ModbusRegisterType register_type, uint16_t start_address,
+                                    const std::vector<uint8_t> &data) {
+    modbusdevice->on_write_register_response(register_type, start_address, data);
+  };
+  auto decoded_and = decode_value(and_mask);
+  auto decoded_or = decode_value(or_mask);
+  cmd.payload = {decoded_and[0], decoded_and[1], decoded_or[0], decoded_or[1]};
   return cmd;
 }
 
@@ -613,7 +1714,7 @@ ModbusCommandItem ModbusCommandItem::create_custom_command(
       ESP_LOGI(TAG, "Custom Command sent");
     };
   } else {
-    cmd.on_data_func = handler;
+    cmd.on_data_func = std::move(handler);
   }
   cmd.payload = values;
 
@@ -632,8 +1733,9 @@ ModbusCommandItem ModbusCommandItem::create_custom_command(
       ESP_LOGI(TAG, "Custom Command sent");
     };
   } else {
-    cmd.on_data_func = handler;
+    cmd.on_data_func = std::move(handler);
   }
+  cmd.payload.reserve(values.size() * 2);
   for (auto v : values) {
     cmd.payload.push_back((v >> 8) & 0xFF);
     cmd.payload.push_back(v & 0xFF);
@@ -643,27 +1745,53 @@ ModbusCommandItem ModbusCommandItem::create_custom_command(
 }
 
 bool ModbusCommandItem::send() {
-  if (this->function_code != ModbusFunctionCode::CUSTOM) {
-    modbusdevice->send(uint8_t(this->function_code), this->register_address, this->register_count, this->payload.size(),
-                       this->payload.empty() ? nullptr : &this->payload[0]);
+  if (this->range_index >= 0) {
+    this->transaction_id = modbusdevice->send_range_request(this->range_index);
+  } else if (this->function_code != ModbusFunctionCode::CUSTOM) {
+    this->transaction_id =
+        modbusdevice->send(uint8_t(this->function_code), this->register_address, this->register_count,
+                           this->payload.size(), this->payload.empty() ? nullptr : &this->payload[0]);
   } else {
-    modbusdevice->send_raw(this->payload);
+    this->transaction_id = modbusdevice->send_raw(this->payload);
   }
   this->send_count_++;
-  ESP_LOGV(TAG, "Command sent %d 0x%X %d send_count: %d", uint8_t(this->function_code), this->register_address,
-           this->register_count, this->send_count_);
-  return true;
+  ESP_LOGV(TAG, "Command sent %d 0x%X %d send_count: %d transaction: %u", uint8_t(this->function_code),
+           this->register_address, this->register_count, this->send_count_, this->transaction_id);
+  return this->transaction_id != 0;
 }
 
-bool ModbusCommandItem::is_equal(const ModbusCommandItem &other) {
+bool ModbusCommandItem::is_equal(const ModbusCommandItem &other) const {
+  if (this->range_index >= 0 || other.range_index >= 0) {
+    return this->range_index == other.range_index;
+  }
   // for custom commands we have to check for identical payloads, since
-  // address/count/type fields will be set to zero
-  return this->function_code == ModbusFunctionCode::CUSTOM
-             ? this->payload == other.payload
+  // address/count/type fields will be set to zero. Read/write commands of the same range differ in the payload
+  return this->function_code == ModbusFunctionCode::CUSTOM ||
+                 this->function_code == ModbusFunctionCode::READ_WRITE_MULTIPLE_REGISTERS
+             ? this->function_code == other.function_code && this->payload == other.payload
              : other.register_address == this->register_address && other.register_count == this->register_count &&
                    other.register_type == this->register_type && other.function_code == this->function_code;
 }
 
+uint32_t ModbusCommandItem::dedup_key() const {
+  uint32_t key;
+  if (this->range_index >= 0) {
+    key = 0x80000000UL | uint32_t(this->range_index);
+  } else if (this->function_code == ModbusFunctionCode::CUSTOM ||
+             this->function_code == ModbusFunctionCode::READ_WRITE_MULTIPLE_REGISTERS) {
+    // FNV-1a of the payload, is_equal compares the whole payload
+    key = 2166136261UL;
+    for (uint8_t b : this->payload) {
+      key = (key ^ b) * 16777619UL;
+    }
+  } else {
+    key = uint32_t(this->function_code) << 24 ^ uint32_t(this->register_type) << 16 ^
+          uint32_t(this->register_count) << 8 ^ this->register_address;
+  }
+  // spread the bits for the bucket index
+  return key * 2654435761UL;
+}
+
 void number_to_payload(std::vector<uint16_t> &data, int64_t value, SensorValueType value_type) {
   switch (value_type) {
     case SensorValueType::U_WORD:
@@ -703,7 +1831,7 @@ void number_to_payload(std::vector<uint16_t> &data, int64_t value, SensorValueTy
   }
 }
 
-int64_t payload_to_number(const std::vector<uint8_t> &data, SensorValueType sensor_value_type, uint8_t offset,
+int64_t payload_to_number(const std::vector<uint8_t> &data, SensorValueType sensor_value_type, uint16_t offset,
                           uint32_t bitmask) {
   int64_t value = 0;  // int64_t because it can hold signed and unsigned 32 bits
 
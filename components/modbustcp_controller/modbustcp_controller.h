@@ -4,10 +4,10 @@
 
 #include "esphome/components/modbustcp/modbustcp.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/preferences.h"
 //#include "esphome/components/modbustcp_controller/automation.h"
 
-#include <list>
-#include <queue>
+#include <array>
 #include <set>
 #include <utility>
 #include <vector>
@@ -17,6 +17,17 @@ namespace modbustcp_controller {
 
 class ModbusTCPController;
 
+/// Scheduling class of a command. Lower values are sent first
+enum class CommandPriority : uint8_t {
+  WRITE = 0,      // writes from switches and other actuators
+  ON_DEMAND = 1,  // reads requested by a lambda or another component
+  POLL = 2,       // range reads of update()
+  LOW = 3,        // range reads of sensors with low_priority: true
+};
+static const uint8_t NUM_COMMAND_PRIORITIES = 4;
+/// a waiting class is served after it was passed over this many times, so polls are never starved
+static const uint8_t PRIORITY_STARVATION_LIMIT = 4;
+
 enum class ModbusFunctionCode {
   CUSTOM = 0x00,
   READ_COILS = 0x01,
@@ -34,8 +45,8 @@ enum class ModbusFunctionCode {
   REPORT_SERVER_ID = 0x11,               // not implemented
   READ_FILE_RECORD = 0x14,               // not implemented
   WRITE_FILE_RECORD = 0x15,              // not implemented
-  MASK_WRITE_REGISTER = 0x16,            // not implemented
-  READ_WRITE_MULTIPLE_REGISTERS = 0x17,  // not implemented
+  MASK_WRITE_REGISTER = 0x16,
+  READ_WRITE_MULTIPLE_REGISTERS = 0x17,
   READ_FIFO_QUEUE = 0x18,                // not implemented
 };
 
@@ -96,7 +107,7 @@ inline ModbusFunctionCode modbus_register_write_function(ModbusRegisterType reg_
       return ModbusFunctionCode::CUSTOM;
       break;
     case ModbusRegisterType::HOLDING:
-      return ModbusFunctionCode::READ_WRITE_MULTIPLE_REGISTERS;
+      return ModbusFunctionCode::WRITE_SINGLE_REGISTER;
       break;
     case ModbusRegisterType::READ:
     default:
@@ -204,11 +215,9 @@ template<typename N> N mask_and_shift_by_rightbit(N data, uint32_t mask) {
   if (result == 0 || mask == 0xFFFFFFFF) {
     return result;
   }
-  for (size_t pos = 0; pos < sizeof(N) << 3; pos++) {
-    if ((mask & (1 << pos)) != 0)
-      return result >> pos;
-  }
-  return 0;
+  // position of the first right set bit, a mask without bits inside N yields 0
+  size_t pos = __builtin_ctz(mask);
+  return pos < sizeof(N) << 3 ? result >> pos : 0;
 }
 
 /** Convert float value to vector<uint16_t> suitable for sending
@@ -226,7 +235,7 @@ void number_to_payload(std::vector<uint16_t> &data, int64_t value, SensorValueTy
  * @param bitmask bitmask used for masking and shifting
  * @return 64-bit number of the payload
  */
-int64_t payload_to_number(const std::vector<uint8_t> &data, SensorValueType sensor_value_type, uint8_t offset,
+int64_t payload_to_number(const std::vector<uint8_t> &data, SensorValueType sensor_value_type, uint16_t offset,
                           uint32_t bitmask);
 
 class ModbusTCPController;
@@ -234,6 +243,13 @@ class ModbusTCPController;
 class SensorItem {
  public:
   virtual void parse_and_publish(const std::vector<uint8_t> &data) = 0;
+  /// true if the decode plan of the range decodes the value and hands it to publish_number()
+  virtual bool decodes_number() const { return false; }
+  /// publish a value decoded by the decode plan of the range. data is the whole response for lambdas
+  virtual void publish_number(int64_t number, const std::vector<uint8_t> &data) {}
+  /// true if the published value only depends on the bytes at offset (coils: the coil at offset), e.g. no lambda
+  /// reads the whole response
+  virtual bool depends_on_own_bytes() const { return false; }
 
   void set_custom_data(const std::vector<uint8_t> &data) { custom_data = data; }
   size_t virtual get_register_size() const {
@@ -249,12 +265,22 @@ class SensorItem {
   SensorValueType sensor_value_type{SensorValueType::RAW};
   uint16_t start_address{0};
   uint32_t bitmask{0};
-  uint8_t offset{0};
+  /// byte offset into the response of the range. For coils and discrete inputs the bit number
+  uint16_t offset{0};
   uint8_t register_count{0};
   uint8_t response_bytes{0};
   uint16_t skip_updates{0};
+  /// poll interval in ms, 0 polls with the update_interval of the controller
+  uint32_t update_interval{0};
+  void set_update_interval(uint32_t update_interval) { this->update_interval = update_interval; }
   std::vector<uint8_t> custom_data{};
   bool force_new_range{false};
+  /// polled with CommandPriority::LOW, behind the other sensors
+  bool low_priority{false};
+  void set_low_priority(bool low_priority) { this->low_priority = low_priority; }
+  /// start_address and offset as configured. create_register_ranges_ changes both when it merges sensors
+  uint16_t configured_address{0};
+  uint16_t configured_offset{0};
 };
 
 class ServerRegister {
@@ -335,6 +361,11 @@ class SensorItemsComparator {
       return lhs->force_new_range > rhs->force_new_range;
     }
 
+    // group sensors with the same poll interval, ranges never mix intervals
+    if (lhs->update_interval != rhs->update_interval) {
+      return lhs->update_interval < rhs->update_interval;
+    }
+
     // sort by start address
     if (lhs->start_address != rhs->start_address) {
       return lhs->start_address < rhs->start_address;
@@ -353,13 +384,58 @@ class SensorItemsComparator {
 
 using SensorSet = std::set<SensorItem *, SensorItemsComparator>;
 
+/// decoder of one value type: reads the value at data and applies the mask and the shift
+using DecodeFunc = int64_t (*)(const uint8_t *data, uint32_t mask, uint8_t shift);
+
+/// One entry of the decode plan of a range, compiled when the ranges are planned
+struct DecodeStep {
+  /// nullptr if the sensor parses the response itself (parse_and_publish)
+  DecodeFunc decode;
+  SensorItem *item;
+  uint32_t mask;
+  /// byte offset of the value in the response
+  uint16_t offset;
+  /// position of the first right set bit of mask
+  uint8_t shift;
+  /// bytes read by decode or by parse_and_publish
+  uint8_t size;
+  /// publishing can be skipped if the bytes read by decode are unchanged
+  bool own_bytes;
+  /// publishing can be skipped if the coil at offset is unchanged
+  bool own_bit;
+};
+
 struct RegisterRange {
   uint16_t start_address;
   ModbusRegisterType register_type;
-  uint8_t register_count;
+  uint16_t register_count;        // up to 125 registers or 2000 coils
   uint16_t skip_updates;          // the config value
-  SensorSet sensors;              // all sensors of this range
+  std::vector<SensorItem *> sensors;  // all sensors of this range in sort order
+  std::vector<DecodeStep> decode_plan;  // one step per sensor, in the order of sensors
+  std::vector<std::pair<uint16_t, uint16_t>> coil_steps;  // (coil, step) of the own_bit steps, sorted by coil
   uint16_t skip_updates_counter;  // the running value
+  std::vector<uint8_t> request_frame;  // fully encoded read request, only the transaction id is patched per send
+  bool disabled{false};           // the device answered ILLEGAL DATA ADDRESS for this single register
+  CommandPriority priority{CommandPriority::POLL};  // LOW if all sensors of the range are low priority
+  uint32_t update_interval{0};    // own poll interval in ms, 0 if polled by update()
+  std::vector<uint8_t> last_data;  // last response if skip_unchanged is set, empty if all sensors have to publish
+  uint32_t last_publish{0};        // time all sensors of the range were published the last time
+};
+
+/// next poll of a range with its own update_interval, or a staggered poll of update() (queued once)
+struct ScheduledPoll {
+  uint32_t due;
+  uint16_t range_index;
+};
+
+/// Max number of learned range splits and holes kept in the preferences
+static const uint8_t MAX_LEARNED_RANGE_ENTRIES = 32;
+
+/// Range splits and illegal addresses learned from ILLEGAL DATA ADDRESS exceptions
+struct LearnedRangePlan {
+  /// register type << 16 | address. LEARNED_HOLE is set for addresses the device doesn't implement
+  uint32_t entries[MAX_LEARNED_RANGE_ENTRIES];
+  uint8_t count;
 };
 
 class ModbusCommandItem {
@@ -372,8 +448,19 @@ class ModbusCommandItem {
   ModbusRegisterType register_type{ModbusRegisterType::CUSTOM};
   std::function<void(ModbusRegisterType register_type, uint16_t start_address, const std::vector<uint8_t> &data)>
       on_data_func;
+  /// called with the exception code if the device rejects the command, with 0 if it was dropped without response
+  std::function<void(uint8_t exception_code)> on_error_func;
   std::vector<uint8_t> payload = {};
+  /// transaction id of the last send, 0 if the command hasn't been sent
+  uint16_t transaction_id{0};
+  /// index of the register range polled by this command, -1 for all other commands
+  int16_t range_index{-1};
+  CommandPriority priority{CommandPriority::ON_DEMAND};
   bool send();
+  /// true if the command waits for a response
+  bool expects_response() const {
+    return this->range_index >= 0 || this->on_data_func != nullptr || this->on_error_func != nullptr;
+  }
   /// Check if the command should be retried based on the max_retries parameter
   bool should_retry(uint8_t max_retries) { return this->send_count_ <= max_retries; };
 
@@ -401,6 +488,13 @@ class ModbusCommandItem {
    */
   static ModbusCommandItem create_read_command(ModbusTCPController *modbusdevice, ModbusRegisterType register_type,
                                                uint16_t start_address, uint16_t register_count);
+  /** Create the poll command of a register range
+   *  Sends the prebuilt request frame of the range, the response is dispatched to the sensors of the range
+   * @param modbusdevice pointer to the device to execute the command
+   * @param range_index index of the range in the register ranges of modbusdevice
+   * @return ModbusCommandItem with the prepared command
+   */
+  static ModbusCommandItem create_range_read_command(ModbusTCPController *modbusdevice, size_t range_index);
   /** Create modbus read command
    *  Function code 02-04
    * @param modbusdevice pointer to the device to execute the command
@@ -422,6 +516,31 @@ class ModbusCommandItem {
    */
   static ModbusCommandItem create_write_single_command(ModbusTCPController *modbusdevice, uint16_t start_address,
                                                        uint16_t value);
+  /** Create modbus read/write multiple registers command
+   *  Function 23 (17hex) Read/Write Multiple registers
+   *  The device writes the values and then answers with the registers of the range containing them, the sensors of
+   *  the range are updated from the response without waiting for the next poll.
+   *  If no range contains the written registers the written registers are read back.
+   *  More than 121 values or more than max_registers_per_write are sent as write multiple registers command, which
+   *  queue_command() splits into chunks of max_registers_per_write.
+   * @param modbusdevice pointer to the device to execute the command
+   * @param start_address modbus address of the first register to write
+   * @param values uint16_t array to be written to the registers
+   * @return ModbusCommandItem with the prepared command
+   */
+  static ModbusCommandItem create_read_write_command(ModbusTCPController *modbusdevice, uint16_t start_address,
+                                                     const std::vector<uint16_t> &values);
+  /** Create modbus mask write register command
+   *  Function 22 (16hex) Mask Write Register
+   *  The device writes (current AND and_mask) OR (or_mask AND NOT and_mask), the other bits are kept.
+   * @param modbusdevice pointer to the device to execute the command
+   * @param address modbus address of the register
+   * @param and_mask bits of the register to keep
+   * @param or_mask new values of the bits cleared in and_mask
+   * @return ModbusCommandItem with the prepared command
+   */
+  static ModbusCommandItem create_mask_write_command(ModbusTCPController *modbusdevice, uint16_t address,
+                                                     uint16_t and_mask, uint16_t or_mask);
   /** Create modbus write single registers command
    *  Function 05 (05hex) Write Single Coil
    * @param modbusdevice pointer to the device to execute the command
@@ -464,7 +583,9 @@ class ModbusCommandItem {
       std::function<void(ModbusRegisterType register_type, uint16_t start_address, const std::vector<uint8_t> &data)>
           &&handler = nullptr);
 
-  bool is_equal(const ModbusCommandItem &other);
+  bool is_equal(const ModbusCommandItem &other) const;
+  /// hash of the fields compared by is_equal, identical commands have the same key
+  uint32_t dedup_key() const;
 
  protected:
   // wrong commands (esp. custom commands) can block the send queue, limit the number of repeats.
@@ -472,6 +593,72 @@ class ModbusCommandItem {
   uint8_t send_count_{0};
 };
 
+/// marks the end of a slot list
+static const uint8_t NO_COMMAND_SLOT = 0xFF;
+/// the command slots are allocated for one poll of every range plus this many other commands
+static const uint8_t MIN_FREE_COMMAND_SLOTS = 8;
+
+/// A preallocated command. The slots are reused, the payload keeps its capacity
+struct CommandSlot {
+  ModbusCommandItem command;
+  /// dedup_key() of the command while it is queued
+  uint32_t key{0};
+  /// next queued slot in the same bucket of the duplicate index
+  uint8_t next{NO_COMMAND_SLOT};
+};
+
+/// Fixed size FIFO of slot indexes. A command can be put back at the front to be retried first
+class CommandRing {
+ public:
+  void init(uint8_t capacity) {
+    this->buffer_.assign(capacity, NO_COMMAND_SLOT);
+    this->head_ = 0;
+    this->count_ = 0;
+  }
+  /// enlarge the ring, the queued slots keep their order
+  void grow(uint8_t capacity) {
+    std::vector<uint8_t> buffer(capacity, NO_COMMAND_SLOT);
+    for (uint8_t i = 0; i < this->count_; i++) {
+      buffer[i] = this->at(i);
+    }
+    this->buffer_ = std::move(buffer);
+    this->head_ = 0;
+  }
+  bool empty() const { return this->count_ == 0; }
+  uint8_t size() const { return this->count_; }
+  uint8_t front() const { return this->buffer_[this->head_]; }
+  uint8_t at(uint8_t i) const { return this->buffer_[(this->head_ + i) % this->buffer_.size()]; }
+  void push_back(uint8_t slot) {
+    this->buffer_[(this->head_ + this->count_) % this->buffer_.size()] = slot;
+    this->count_++;
+  }
+  void push_front(uint8_t slot) {
+    this->head_ = (this->head_ + this->buffer_.size() - 1) % this->buffer_.size();
+    this->buffer_[this->head_] = slot;
+    this->count_++;
+  }
+  void pop_front() {
+    this->head_ = (this->head_ + 1) % this->buffer_.size();
+    this->count_--;
+  }
+  /// remove all slots matching pred, the order of the others is kept
+  template<typename Pred> void remove_if(Pred pred) {
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < this->count_; i++) {
+      uint8_t slot = this->at(i);
+      if (!pred(slot)) {
+        this->buffer_[(this->head_ + kept++) % this->buffer_.size()] = slot;
+      }
+    }
+    this->count_ = kept;
+  }
+
+ protected:
+  std::vector<uint8_t> buffer_;
+  uint8_t head_{0};
+  uint8_t count_{0};
+};
+
 /** Modbus controller class.
  *   Each instance handles the modbus commuinication for all sensors with the same modbus address
  *
@@ -487,38 +674,70 @@ class ModbusTCPController : public PollingComponent, public modbustcp::ModbusDev
   void setup() override;
   void update() override;
 
-  /// queues a modbus command in the send queue
+  /// queues a modbus command in the send queue of its priority
   void queue_command(const ModbusCommandItem &command);
-  /// Registers a sensor with the controller. Called by esphomes code generator
-  void add_sensor_item(SensorItem *item) { sensorset_.insert(item); }
+  /// read the range of a sensor now, ahead of the regular polls
+  void request_update(SensorItem *item);
+  /// Registers a sensor with the controller. Called by esphomes code generator after all properties the
+  /// SensorItemsComparator sorts by are set - changing them later breaks the order of sensorset_
+  void add_sensor_item(SensorItem *item) {
+    item->configured_address = item->start_address;
+    item->configured_offset = item->offset;
+    sensorset_.insert(item);
+  }
   /// Registers a server register with the controller. Called by esphomes code generator
   void add_server_register(ServerRegister *server_register) { server_registers_.push_back(server_register); }
   /// called when a modbus response was parsed without errors
-  void on_modbus_data(const std::vector<uint8_t> &data) override;
+  void on_modbus_data(uint16_t transaction_id, const std::vector<uint8_t> &data) override;
   /// called when a modbus error response was received
-  void on_modbus_error(uint8_t function_code, uint8_t exception_code) override;
+  void on_modbus_error(uint16_t transaction_id, uint8_t function_code, uint8_t exception_code) override;
+  /// called when a request timed out
+  void on_modbus_timeout(uint16_t transaction_id) override;
+  /// a command is queued and command_throttle allows to send it
+  bool has_pending_request() override;
+  /// send the next modbus command from the send queues, called by the transport
+  bool send_pending_request() override;
   /// called when a modbus request (function code 0x03 or 0x04) was parsed without errors
-  void on_modbus_read_registers(uint8_t function_code, uint16_t start_address, uint16_t number_of_registers) final;
+  void on_modbus_read_registers(uint16_t transaction_id, uint8_t function_code, uint16_t start_address,
+                                uint16_t number_of_registers) final;
   /// called when a modbus request (function code 0x06 or 0x10) was parsed without errors
-  void on_modbus_write_registers(uint8_t function_code, const std::vector<uint8_t> &data) final;
+  void on_modbus_write_registers(uint16_t transaction_id, uint8_t function_code,
+                                 const std::vector<uint8_t> &data) final;
   /// default delegate called by process_modbus_data when a response has retrieved from the incoming queue
   void on_register_data(ModbusRegisterType register_type, uint16_t start_address, const std::vector<uint8_t> &data);
   /// default delegate called by process_modbus_data when a response for a write response has retrieved from the
   /// incoming queue
   void on_write_register_response(ModbusRegisterType register_type, uint16_t start_address,
                                   const std::vector<uint8_t> &data);
+  /// called by esphome generated code to merge queued writes to neighbouring addresses
+  void set_coalesce_writes(bool coalesce_writes) { this->coalesce_writes_ = coalesce_writes; }
   /// Allow a duplicate command to be sent
   void set_allow_duplicate_commands(bool allow_duplicate_commands) {
     this->allow_duplicate_commands_ = allow_duplicate_commands;
   }
   /// get if a duplicate command can be sent
   bool get_allow_duplicate_commands() { return this->allow_duplicate_commands_; }
+  /// called by esphome generated code to set the number of preallocated command slots
+  void set_command_queue_size(uint8_t command_queue_size) { this->command_queue_size_ = command_queue_size; }
   /// called by esphome generated code to set the command_throttle period
   void set_command_throttle(uint16_t command_throttle) { this->command_throttle_ = command_throttle; }
+  /// called by esphome generated code to set the max time in µs loop() spends processing responses
+  void set_loop_budget(uint32_t loop_budget_us) { this->loop_budget_us_ = loop_budget_us; }
+  /// called by esphome generated code to spread the range polls of update() across the update interval
+  void set_stagger_polls(bool stagger_polls) { this->stagger_polls_ = stagger_polls; }
+  /// called by esphome generated code to set the max random shift in ms of a staggered poll
+  void set_poll_jitter(uint32_t poll_jitter) { this->poll_jitter_ = poll_jitter; }
+  /// called by esphome generated code to skip publishing values of unchanged responses
+  void set_skip_unchanged(bool skip_unchanged) { this->skip_unchanged_ = skip_unchanged; }
+  /// called by esphome generated code to set the interval in ms all values are published even if unchanged
+  void set_heartbeat_interval(uint32_t heartbeat_interval) { this->heartbeat_interval_ = heartbeat_interval; }
+  /// queue depth statistics of the last update interval: max and average number of queued commands
+  uint8_t get_queue_depth_max() const { return this->last_queue_depth_max_; }
+  float get_queue_depth_avg() const { return this->last_queue_depth_avg_; }
   /// called by esphome generated code to set the offline_skip_updates
   void set_offline_skip_updates(uint16_t offline_skip_updates) { this->offline_skip_updates_ = offline_skip_updates; }
-  /// get the number of queued modbus commands (should be mostly empty)
-  size_t get_command_queue_length() { return command_queue_.size(); }
+  /// get the number of queued and in-flight modbus commands (should be mostly empty)
+  size_t get_command_queue_length() { return this->queued_commands_() + inflight_.size(); }
   /// get if the module is offline, didn't respond the last command
   bool get_module_offline() { return module_offline_; }
   /// Set callback for commands
@@ -531,18 +750,64 @@ class ModbusTCPController : public PollingComponent, public modbustcp::ModbusDev
   void set_max_cmd_retries(uint8_t max_cmd_retries) { this->max_cmd_retries_ = max_cmd_retries; }
   /// get how many times a command will be (re)sent if no response is received
   uint8_t get_max_cmd_retries() { return this->max_cmd_retries_; }
+  /// called by esphome generated code to set the max number of unused registers read to merge two ranges
+  void set_max_gap(uint16_t max_gap) { this->max_gap_ = max_gap; }
+  /// called by esphome generated code to limit the registers read by one request
+  void set_max_registers_per_read(uint16_t max_registers) { this->max_registers_per_read_ = max_registers; }
+  /// called by esphome generated code to limit the registers written by one request
+  void set_max_registers_per_write(uint16_t max_registers) { this->max_registers_per_write_ = max_registers; }
+  uint16_t get_max_registers_per_write() const { return this->max_registers_per_write_; }
+  /// called by esphome generated code to find the largest read the device accepts before polling starts
+  void set_probe_max_registers(bool probe_max_registers) { this->probe_max_registers_ = probe_max_registers; }
+  uint16_t get_max_registers_per_read() const { return this->max_registers_per_read_; }
+  /// called by esphome generated code to keep the learned range splits in the preferences
+  void set_persist_learned_ranges(bool persist_learned_ranges) {
+    this->persist_learned_ranges_ = persist_learned_ranges;
+  }
+  /// send the prebuilt request of a register range
+  uint16_t send_range_request(size_t range_index);
+  /// the register ranges polled by this controller
+  const std::vector<RegisterRange> &get_register_ranges() const { return this->register_ranges_; }
 
  protected:
   /// parse sensormap_ and create range of sequential addresses
   size_t create_register_ranges_();
-  // find register in sensormap. Returns iterator with all registers having the same start address
-  SensorSet find_sensors_(ModbusRegisterType register_type, uint16_t start_address) const;
+  /// find the range starting at start_address, nullptr if there is none
+  const RegisterRange *find_range_(ModbusRegisterType register_type, uint16_t start_address) const;
+  /// publish the response of a range read to the sensors of the range
+  void on_range_data_(size_t range_index, const std::vector<uint8_t> &data);
   /// submit the read command for the address range to the send queue
-  void update_range_(RegisterRange &r);
+  void update_range_(size_t range_index);
+  /// queue the reads of the ranges with their own update_interval that are due
+  void poll_due_ranges_();
+  /// rebuild the deadline heap after the ranges changed
+  void schedule_ranges_();
+  /// spread the reads of the ranges polled by update() across the update interval
+  void stagger_range_polls_();
+  /// sample the number of queued commands for the queue depth statistics
+  void sample_queue_depth_();
+  /// check if a sensor can be appended to a range by reading the unused registers in between
+  bool can_extend_range_(const RegisterRange &r, const SensorItem *item, uint16_t buffer_offset) const;
+  /// bisect a range the device answered with ILLEGAL DATA ADDRESS
+  void learn_illegal_range_(size_t range_index);
+  /// true if a learned entry with this flag exists for the address
+  bool has_learned_entry_(ModbusRegisterType register_type, uint16_t address, uint32_t flag) const;
+  /// rebuild the register ranges after the learned plan changed
+  void replan_ranges_();
+  /// start probing the largest read the device accepts
+  void start_probe_();
+  /// next probe step after a probe read succeeded or failed
+  void probe_step_();
+  /// queue a probe read of count registers
+  void send_probe_(uint16_t count);
+  /// encode the read request of a range once so sending only needs to patch the transaction id
+  void build_range_frame_(RegisterRange &r);
+  /// compile the decoder, offset, mask and shift of every sensor of a range
+  void build_decode_plan_(RegisterRange &r);
+  /// publish the items of the coils that differ from the last response of a coil or discrete input range
+  void publish_flipped_coils_(const RegisterRange &r, const std::vector<uint8_t> &data);
   /// parse incoming modbus data
   void process_modbus_data_(const ModbusCommandItem *response);
-  /// send the next modbus command from the send queue
-  bool send_next_command_();
   /// dump the parsed sensormap for diagnostics
   void dump_sensors_();
   /// Collection of all sensors for this component
@@ -551,22 +816,107 @@ class ModbusTCPController : public PollingComponent, public modbustcp::ModbusDev
   std::vector<ServerRegister *> server_registers_{};
   /// Continuous range of modbus registers
   std::vector<RegisterRange> register_ranges_{};
-  /// Hold the pending requests to be sent
-  std::list<std::unique_ptr<ModbusCommandItem>> command_queue_;
+  /// values of the range being dispatched, decoded before any sensor publishes. Sized when the ranges are planned
+  std::vector<int64_t> decoded_values_{};
+  /// steps of the range being dispatched whose bytes are unchanged. Bytes, not std::vector<bool>: the bit proxies
+  /// cost more than decoding the value
+  std::vector<uint8_t> unchanged_steps_{};
+  bool skip_unchanged_{false};
+  /// 0: unchanged values are never published again
+  uint32_t heartbeat_interval_{0};
+  /// min-heap on the deadline of the ranges with their own update_interval and of staggered update() polls
+  std::vector<ScheduledPoll> poll_schedule_{};
+  bool stagger_polls_{false};
+  uint32_t poll_jitter_{0};
+  /// queue depth samples of the running update interval
+  uint8_t queue_depth_max_{0};
+  uint32_t queue_depth_sum_{0};
+  uint32_t queue_depth_samples_{0};
+  /// queue depth statistics of the last update interval
+  uint8_t last_queue_depth_max_{0};
+  float last_queue_depth_avg_{0};
+  /// allocate the command slots, the queues and the duplicate index
+  void init_command_slots_();
+  /// add slots after a replan created more ranges than the slots were sized for
+  void grow_command_slots_();
+  /// take a free slot, NO_COMMAND_SLOT if all are in use
+  uint8_t alloc_slot_();
+  void release_slot_(uint8_t slot) { this->free_slots_.push_back(slot); }
+  /// append a slot to the send queue of its priority (or put it back at the front) and add it to the duplicate index
+  void enqueue_slot_(uint8_t slot, bool front);
+  /// add a queued slot to the duplicate index
+  void index_add_(uint8_t slot);
+  /// merge a register or coil write into the last queued write if their addresses touch or overlap
+  bool coalesce_write_(const ModbusCommandItem &command);
+  /// the send queue to serve next, -1 if all are empty
+  int8_t next_queue_() const;
+  /// take the slot at the front of a send queue and remove it from the duplicate index
+  uint8_t dequeue_slot_(uint8_t queue);
+  size_t queued_commands_() const;
+  /// queued slot with a command equal to command, NO_COMMAND_SLOT if there is none
+  uint8_t find_queued_(const ModbusCommandItem &command, uint32_t key) const;
+  void index_remove_(uint8_t slot);
+  size_t bucket_(uint32_t key) const { return (key ^ (key >> 16)) & (this->dedup_buckets_.size() - 1); }
+  /// find the in-flight command for a transaction id
+  std::vector<uint8_t>::iterator find_inflight_(uint16_t transaction_id);
+  /// remove a slot from the in-flight list, the order doesn't matter
+  void erase_inflight_(std::vector<uint8_t>::iterator it) {
+    *it = this->inflight_.back();
+    this->inflight_.pop_back();
+  }
+  /// storage of all commands, allocated in setup() and never resized
+  std::vector<CommandSlot> command_slots_;
+  /// slots not used by any queue
+  std::vector<uint8_t> free_slots_;
+  /// Hold the pending requests to be sent, one queue per CommandPriority
+  std::array<CommandRing, NUM_COMMAND_PRIORITIES> command_queues_;
+  /// how often each queue was passed over for a higher priority since it was served
+  std::array<uint8_t, NUM_COMMAND_PRIORITIES> passed_over_{};
+  /// commands sent and waiting for their response
+  std::vector<uint8_t> inflight_;
   /// modbus response data waiting to get processed
-  std::queue<std::unique_ptr<ModbusCommandItem>> incoming_queue_;
+  CommandRing incoming_queue_;
+  /// first queued slot of each bucket, chained through CommandSlot::next. Power of 2 size
+  std::vector<uint8_t> dedup_buckets_;
+  /// configured number of command slots
+  uint8_t command_queue_size_{32};
   /// if duplicate commands can be sent
   bool allow_duplicate_commands_{false};
+  /// if writes to neighbouring addresses are merged into one write multiple command
+  bool coalesce_writes_{true};
   /// when was the last send operation
   uint32_t last_command_timestamp_{0};
   /// min time in ms between sending modbus commands
   uint16_t command_throttle_{0};
+  /// max time in µs spent processing responses per loop iteration
+  uint32_t loop_budget_us_{2000};
   /// if module didn't respond the last command
   bool module_offline_{false};
   /// how many updates to skip if module is offline
   uint16_t offline_skip_updates_{0};
   /// How many times we will retry a command if we get no response
   uint8_t max_cmd_retries_{4};
+  /// max unused registers (16 coils count as one register) read to avoid a separate request
+  uint16_t max_gap_{0};
+  /// largest read/write the device accepts, configured or found by the probe
+  uint16_t max_registers_per_read_{modbustcp::MAX_NUM_OF_REGISTERS_TO_READ};
+  uint16_t max_registers_per_write_{modbustcp::MAX_NUM_OF_REGISTERS_TO_WRITE};
+  bool probe_max_registers_{false};
+  /// probe state: running, finished and the register counts known to work / the largest count not known to fail
+  bool probing_{false};
+  bool probe_done_{false};
+  /// the device answered the first probe read
+  bool probe_answered_{false};
+  ModbusRegisterType probe_type_{ModbusRegisterType::HOLDING};
+  uint16_t probe_address_{0};
+  uint16_t probe_low_{1};
+  uint16_t probe_high_{1};
+  /// addresses where a new range has to start or which must not be read, learned from exceptions
+  std::vector<uint32_t> learned_plan_{};
+  /// learned_plan_ changed, create_register_ranges_ has to run again
+  bool replan_pending_{false};
+  bool persist_learned_ranges_{false};
+  ESPPreferenceObject learned_plan_pref_;
   /// Command sent callback
   CallbackManager<void(int, int)> command_sent_callback_{};
   /// Server online callback
@@ -64,5 +64,5 @@ async def to_code(config):
     await sensor.register_sensor(var, config)
 
     paren = await cg.get_variable(config[CONF_MODBUSTCP_CONTROLLER_ID])
-    cg.add(paren.add_sensor_item(var))
     await add_modbus_base_properties(var, config, ModbusTCPSensor)
+    cg.add(paren.add_sensor_item(var))
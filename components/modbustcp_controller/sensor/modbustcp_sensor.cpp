@@ -10,7 +10,16 @@ static const char *const TAG = "modbustcp_controller.sensor";
 void ModbusTCPSensor::dump_config() { LOG_SENSOR(TAG, "Modbus Controller Sensor", this); }
 
 void ModbusTCPSensor::parse_and_publish(const std::vector<uint8_t> &data) {
-  float result = payload_to_float(data, *this);
+  this->publish_number(payload_to_number(data, this->sensor_value_type, this->offset, this->bitmask), data);
+}
+
+void ModbusTCPSensor::publish_number(int64_t number, const std::vector<uint8_t> &data) {
+  float result;
+  if (value_type_is_float(this->sensor_value_type)) {
+    result = bit_cast<float>(static_cast<uint32_t>(number));
+  } else {
+    result = static_cast<float>(number);
+  }
 
   // Is there a lambda registered
   // call it with the pre converted value and the raw data array
@@ -24,6 +24,9 @@ class ModbusTCPSensor : public Component, public sensor::Sensor, public SensorIt
   }
 
   void parse_and_publish(const std::vector<uint8_t> &data) override;
+  bool decodes_number() const override { return true; }
+  bool depends_on_own_bytes() const override { return !this->transform_func_.has_value(); }
+  void publish_number(int64_t number, const std::vector<uint8_t> &data) override;
   void dump_config() override;
   using transform_func_t = std::function<optional<float>(ModbusTCPSensor *, float, const std::vector<uint8_t> &)>;
 
@@ -18,6 +18,7 @@ from ..const import (
     CONF_MODBUSTCP_CONTROLLER_ID,
     CONF_REGISTER_TYPE,
     CONF_SKIP_UPDATES,
+    CONF_USE_MASK_WRITE,
     CONF_USE_WRITE_MULTIPLE,
     CONF_WRITE_LAMBDA,
 )
@@ -39,6 +40,7 @@ CONFIG_SCHEMA = cv.All(
             cv.Optional(CONF_ASSUMED_STATE, default=False): cv.boolean,
             cv.Optional(CONF_REGISTER_TYPE): cv.enum(MODBUS_REGISTER_TYPE),
             cv.Optional(CONF_USE_WRITE_MULTIPLE, default=False): cv.boolean,
+            cv.Optional(CONF_USE_MASK_WRITE, default=False): cv.boolean,
             cv.Optional(CONF_WRITE_LAMBDA): cv.returning_lambda,
         }
     ),
@@ -63,10 +65,9 @@ async def to_code(config):
     paren = await cg.get_variable(config[CONF_MODBUSTCP_CONTROLLER_ID])
     cg.add(var.set_parent(paren))
     cg.add(var.set_use_write_mutiple(config[CONF_USE_WRITE_MULTIPLE]))
+    cg.add(var.set_use_mask_write(config[CONF_USE_MASK_WRITE]))
     assumed_state = config[CONF_ASSUMED_STATE]
     cg.add(var.set_assumed_state(assumed_state))
-    if not assumed_state:
-        cg.add(paren.add_sensor_item(var))
     if CONF_WRITE_LAMBDA in config:
         template_ = await cg.process_lambda(
             config[CONF_WRITE_LAMBDA],
@@ -79,3 +80,5 @@ async def to_code(config):
         )
         cg.add(var.set_write_template(template_))
     await add_modbus_base_properties(var, config, ModbusTCPSwitch, bool, bool)
+    if not assumed_state:
+        cg.add(paren.add_sensor_item(var))
@@ -88,6 +88,11 @@ void ModbusTCPSwitch::write_state(bool state) {
       } else {
         cmd = ModbusCommandItem::create_write_single_coil(this->parent_, this->start_address + this->offset, state);
       }
+    } else if (this->use_mask_write_ && (this->bitmask & 0xFFFF) != 0xFFFF && (this->bitmask & 0xFFFF) != 0) {
+      // only the bits of the mask change - one atomic transaction instead of a read-modify-write
+      uint16_t mask = this->bitmask & 0xFFFF;
+      cmd = ModbusCommandItem::create_mask_write_command(this->parent_, this->start_address + this->offset / 2,
+                                                         ~mask, state ? mask : 0);
     } else {
       // since offset is in bytes and a register is 16 bits we get the start by adding offset/2
       if (this->use_write_multiple_) {
@@ -100,6 +105,8 @@ void ModbusTCPSwitch::write_state(bool state) {
       }
     }
   }
+  // actuation goes ahead of the polls, also for custom commands
+  cmd.priority = CommandPriority::WRITE;
   this->parent_->queue_command(cmd);
   this->publish_state(state);
 }
@@ -32,6 +32,7 @@ class ModbusTCPSwitch : public Component, public switch_::Switch, public SensorI
   void set_assumed_state(bool assumed_state);
   void set_state(bool state) { this->state = state; }
   void parse_and_publish(const std::vector<uint8_t> &data) override;
+  bool depends_on_own_bytes() const override { return !this->publish_transform_func_.has_value(); }
   void set_parent(ModbusTCPController *parent) { this->parent_ = parent; }
 
   using transform_func_t = optional<bool> (*)(ModbusTCPSwitch *, bool, const std::vector<uint8_t> &);
@@ -39,11 +40,14 @@ class ModbusTCPSwitch : public Component, public switch_::Switch, public SensorI
   void set_template(transform_func_t f) { this->publish_transform_func_ = f; }
   void set_write_template(write_transform_func_t f) { this->write_transform_func_ = f; }
   void set_use_write_mutiple(bool use_write_multiple) { this->use_write_multiple_ = use_write_multiple; }
+  void set_use_mask_write(bool use_mask_write) { this->use_mask_write_ = use_mask_write; }
 
  protected:
   bool assumed_state() override;
   ModbusTCPController *parent_{nullptr};
   bool use_write_multiple_{false};
+  /// write the bits of a partial bitmask with function 22 and keep the other bits of the register
+  bool use_mask_write_{false};
   optional<transform_func_t> publish_transform_func_{nullopt};
   optional<write_transform_func_t> write_transform_func_{nullopt};
   bool assumed_state_{false};
@@ -0,0 +1,94 @@
+// Heap allocations and time per request of the ModbusTCP send path, against tools/modbus_sim.py.
+//
+//   tools/bench/run.sh alloc [requests]
+//
+// bench-variant: host -DUSE_HOST
+// bench-sim: --latency 0
+#include "esphome/components/modbustcp/modbustcp.h"
+#include "bench.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace esphome;
+using namespace esphome::modbustcp;
+
+class Device : public ModbusDevice {
+ public:
+  void on_modbus_data(uint16_t transaction_id, const std::vector<uint8_t> &data) override { this->responses++; }
+  void on_modbus_error(uint16_t transaction_id, uint8_t function_code, uint8_t exception_code) override {
+    this->responses++;
+  }
+  void on_modbus_timeout(uint16_t transaction_id) override { this->responses++; }
+  uint32_t responses{0};
+};
+
+struct Result {
+  double send_allocations;
+  double round_trip_allocations;
+  double send_us;
+};
+
+// send requests one by one and wait for each response
+template<typename F> static Result run(ModbusTCP &tcp, Device &device, int requests, F &&send) {
+  uint64_t send_allocations = 0;
+  uint32_t send_us = 0;
+  uint64_t allocations = bench::allocations;
+  for (int i = 0; i < requests; i++) {
+    uint32_t expected = device.responses + 1;
+    uint64_t before = bench::allocations;
+    uint32_t start = micros();
+    if (send(i) == 0) {
+      fprintf(stderr, "send failed\n");
+      exit(1);
+    }
+    send_us += micros() - start;
+    send_allocations += bench::allocations - before;
+    while (device.responses != expected) {
+      tcp.loop();
+    }
+  }
+  return {double(send_allocations) / requests, double(bench::allocations - allocations) / requests,
+          double(send_us) / requests};
+}
+
+int main(int argc, char **argv) {
+  int requests = argc > 1 ? atoi(argv[1]) : 20000;
+
+  ModbusTCP tcp;
+  tcp.set_host("127.0.0.1");
+  tcp.set_port(bench::sim_port());
+  Device device;
+  device.set_parent(&tcp);
+  device.set_address(1);
+  tcp.register_device(&device);
+  tcp.setup();
+
+  tcp.ensure_tcp_client();
+  for (int i = 0; i < 1000 && !tcp.client_ready_; i++) {
+    delay(1);
+    tcp.ensure_tcp_client();
+  }
+  if (!tcp.client_ready_) {
+    fprintf(stderr, "can't connect to the simulator on port %u\n", bench::sim_port());
+    return 1;
+  }
+
+  // warm up: connection, receive vector capacity
+  run(tcp, device, 100, [&](int i) { return device.send(0x03, 1000, 10); });
+
+  Result read = run(tcp, device, requests, [&](int i) { return device.send(0x03, 1000 + i % 100, 10); });
+  uint8_t values[20] = {};
+  Result write = run(tcp, device, requests, [&](int i) { return device.send(0x10, 2000, 10, sizeof(values), values); });
+  std::vector<uint8_t> raw = {1, 0x03, 0x03, 0xE8, 0x00, 0x0A};
+  Result custom = run(tcp, device, requests, [&](int i) { return device.send_raw(raw); });
+
+  printf("%-24s %12s %12s %14s\n", "request", "allocs/send", "allocs/rtt", "us/send");
+  printf("%-24s %12.2f %12.2f %14.2f\n", "read holding (FC3)", read.send_allocations, read.round_trip_allocations,
+         read.send_us);
+  printf("%-24s %12.2f %12.2f %14.2f\n", "write multiple (FC16)", write.send_allocations,
+         write.round_trip_allocations, write.send_us);
+  printf("%-24s %12.2f %12.2f %14.2f\n", "send_raw", custom.send_allocations, custom.round_trip_allocations,
+         custom.send_us);
+  return 0;
+}
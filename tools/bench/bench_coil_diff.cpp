@@ -0,0 +1,73 @@
+// Publishing the coils of a large range when only a few of them flip between two polls, with and without
+// skip_unchanged. Every response is checked against the states the binary sensors end up with.
+//
+//   tools/bench/run.sh coil_diff [responses]
+//
+// bench-variant: O2 -DUSE_HOST -DESPHOME_LOG_LEVEL=ESPHOME_LOG_LEVEL_INFO -O2
+// bench-variant: Os -DUSE_HOST -DESPHOME_LOG_LEVEL=ESPHOME_LOG_LEVEL_INFO -Os
+#include "esphome/components/modbustcp_controller/binary_sensor/modbustcp_binarysensor.h"
+#include "esphome/components/modbustcp_controller/modbustcp_controller.h"
+#include "bench.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace esphome;
+using namespace esphome::modbustcp_controller;
+
+/// exposes the range dispatch of the controller
+class Controller : public ModbusTCPController {
+ public:
+  using ModbusTCPController::on_range_data_;
+};
+
+int main(int argc, char **argv) {
+  int responses = argc > 1 ? atoi(argv[1]) : 20000;
+  const uint16_t coils = 2000;
+  const int flips = 4;
+
+  printf("%u coils, %d flipped per response\n", coils, flips);
+  printf("%-16s %14s %18s %8s\n", "skip_unchanged", "us/response", "publishes/response", "wrong");
+  for (bool skip_unchanged : {false, true}) {
+    modbustcp::ModbusTCP tcp;
+    Controller controller;
+    controller.set_parent(&tcp);
+    controller.set_address(1);
+    controller.set_skip_unchanged(skip_unchanged);
+    std::vector<ModbusTCPBinarySensor *> sensors;
+    for (uint16_t address = 0; address < coils; address++) {
+      auto *sensor = new ModbusTCPBinarySensor(ModbusRegisterType::COIL, address, 0, 1, 0, false);
+      controller.add_sensor_item(sensor);
+      sensors.push_back(sensor);
+    }
+    tcp.register_device(&controller);
+    controller.setup();
+
+    std::vector<uint8_t> base((coils + 7) / 8, 0x5A);
+    std::vector<uint8_t> data = base;
+    controller.on_range_data_(0, data);
+
+    uint64_t publishes = bench::publishes;
+    uint64_t wrong = 0;
+    double us = 0;
+    for (int r = 0; r < responses; r++) {
+      data = base;
+      for (int k = 0; k < flips; k++) {
+        int coil = (r * 7 + k * 499) % coils;
+        data[coil / 8] ^= 1 << (coil % 8);
+      }
+      auto start = std::chrono::steady_clock::now();
+      controller.on_range_data_(0, data);
+      us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      if (r % 100 == 0) {
+        for (auto *sensor : sensors) {
+          wrong += sensor->state != coil_from_vector(sensor->offset, data);
+        }
+      }
+    }
+    printf("%-16s %14.2f %18.1f %8llu\n", skip_unchanged ? "on" : "off", us / responses,
+           double(bench::publishes - publishes) / responses, (unsigned long long) wrong);
+  }
+  return 0;
+}
@@ -0,0 +1,123 @@
+// Decoding the values of a register range: the decode plan of the controller against payload_to_number() per
+// sensor, which is what parse_and_publish() does. Both paths must publish the same states. Built at INFO log level
+// so the per value debug logs of the sensors are compiled out.
+//
+//   tools/bench/run.sh decode [responses]
+//
+// bench-variant: O2 -DUSE_HOST -DESPHOME_LOG_LEVEL=ESPHOME_LOG_LEVEL_INFO -O2
+// bench-variant: Os -DUSE_HOST -DESPHOME_LOG_LEVEL=ESPHOME_LOG_LEVEL_INFO -Os
+#include "esphome/components/modbustcp_controller/modbustcp_controller.h"
+#include "esphome/components/modbustcp_controller/sensor/modbustcp_sensor.h"
+#include "bench.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace esphome;
+using namespace esphome::modbustcp_controller;
+
+static const SensorValueType VALUE_TYPES[] = {
+    SensorValueType::U_WORD,    SensorValueType::S_WORD,    SensorValueType::U_DWORD, SensorValueType::S_DWORD,
+    SensorValueType::U_DWORD_R, SensorValueType::S_DWORD_R, SensorValueType::U_QWORD, SensorValueType::S_QWORD,
+    SensorValueType::U_QWORD_R, SensorValueType::S_QWORD_R, SensorValueType::FP32,    SensorValueType::FP32_R,
+};
+static const uint8_t REGISTER_COUNTS[] = {1, 1, 2, 2, 2, 2, 4, 4, 4, 4, 2, 2};
+
+static bool same(float a, float b) { return a == b || (std::isnan(a) && std::isnan(b)); }
+
+int main(int argc, char **argv) {
+  int responses = argc > 1 ? atoi(argv[1]) : 200000;
+
+  // 40 sensors of mixed types back to back in one range of holding registers, every 4th one masked
+  modbustcp::ModbusTCP tcp;
+  ModbusTCPController controller;
+  controller.set_parent(&tcp);
+  controller.set_address(1);
+  std::vector<ModbusTCPSensor *> sensors;
+  uint16_t address = 1000;
+  for (int i = 0; i < 40; i++) {
+    uint32_t bitmask = i % 4 == 0 ? 0x00F0 : 0xFFFFFFFF;
+    auto *sensor = new ModbusTCPSensor(ModbusRegisterType::HOLDING, address, 0, bitmask, VALUE_TYPES[i % 12],
+                                       REGISTER_COUNTS[i % 12], 0, false);
+    address += REGISTER_COUNTS[i % 12];
+    controller.add_sensor_item(sensor);
+    sensors.push_back(sensor);
+  }
+  tcp.register_device(&controller);
+  controller.setup();
+  const auto &range = controller.get_register_ranges().front();
+  if (controller.get_register_ranges().size() != 1) {
+    fprintf(stderr, "expected one range, got %zu\n", controller.get_register_ranges().size());
+    return 1;
+  }
+
+  std::mt19937 rng(1);
+  std::vector<std::vector<uint8_t>> pool(64, std::vector<uint8_t>(range.register_count * 2));
+  for (auto &data : pool) {
+    for (auto &b : data) {
+      b = rng();
+    }
+  }
+
+  // both paths publish the same states
+  int mismatches = 0;
+  std::vector<float> expected(sensors.size());
+  for (auto &data : pool) {
+    for (size_t i = 0; i < sensors.size(); i++) {
+      sensors[i]->parse_and_publish(data);
+      expected[i] = sensors[i]->state;
+    }
+    controller.on_register_data(ModbusRegisterType::HOLDING, range.start_address, data);
+    for (size_t i = 0; i < sensors.size(); i++) {
+      mismatches += !same(sensors[i]->state, expected[i]);
+    }
+  }
+
+  double values = double(responses) * sensors.size();
+  auto ns_per_value = [values](std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / values;
+  };
+
+  // decoding only
+  volatile int64_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < responses; r++) {
+    const auto &data = pool[r % pool.size()];
+    for (auto *sensor : sensors) {
+      sink = sink + payload_to_number(data, sensor->sensor_value_type, sensor->offset, sensor->bitmask);
+    }
+  }
+  double decode_per_sensor = ns_per_value(start);
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < responses; r++) {
+    const auto &data = pool[r % pool.size()];
+    for (const auto &step : range.decode_plan) {
+      sink = sink + step.decode(data.data() + step.offset, step.mask, step.shift);
+    }
+  }
+  double decode_plan = ns_per_value(start);
+
+  // decoding and publishing a response
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < responses; r++) {
+    const auto &data = pool[r % pool.size()];
+    for (auto *sensor : sensors) {
+      sensor->parse_and_publish(data);
+    }
+  }
+  double publish_per_sensor = ns_per_value(start);
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < responses; r++) {
+    controller.on_register_data(ModbusRegisterType::HOLDING, range.start_address, pool[r % pool.size()]);
+  }
+  double publish_plan = ns_per_value(start);
+
+  printf("%zu sensors, %u registers, %d mismatches\n", sensors.size(), range.register_count, mismatches);
+  printf("%-10s %22s %14s\n", "ns/value", "payload_to_number", "decode plan");
+  printf("%-10s %22.2f %14.2f\n", "decode", decode_per_sensor, decode_plan);
+  printf("%-10s %22.2f %14.2f\n", "publish", publish_per_sensor, publish_plan);
+  return mismatches != 0;
+}
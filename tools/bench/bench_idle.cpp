@@ -0,0 +1,136 @@
+// Cost of an idle ModbusTCP::loop(), request round trip time and how fast a connection closed by the server is
+// noticed while idle, for the receive modes of the socket transport.
+//
+//   tools/bench/run.sh idle [seconds]
+//
+// idf_poll: ESP-IDF without main loop select() support, idf_select: ESP-IDF with USE_SOCKET_SELECT_SUPPORT,
+// host_epoll: host without select() support, host_select: host with it (the ESPHome default). The ESP-IDF flavour
+// is built against POSIX sockets (shim/lwip).
+//
+// Every loop() is preceded by the sleep of the main loop (App.select_sockets()): up to LOOP_INTERVAL ms, cut short
+// by a registered socket becoming readable. Loops per second show whether an idle loop sleeps, the CPU time per
+// loop includes the sleep's own system call.
+//
+// bench-variant: idf_poll
+// bench-variant: idf_select -DUSE_SOCKET_SELECT_SUPPORT
+// bench-variant: host_epoll -DUSE_HOST
+// bench-variant: host_select -DUSE_HOST -DUSE_SOCKET_SELECT_SUPPORT
+// bench-sim: --latency 0
+#include "esphome/components/modbustcp/modbustcp.h"
+#include "esphome/core/application.h"
+#include "bench.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace esphome;
+using namespace esphome::modbustcp;
+
+/// default loop interval of the ESPHome main loop
+static const uint32_t LOOP_INTERVAL = 16;
+
+static void main_loop(ModbusTCP &tcp) {
+  App.select_sockets(LOOP_INTERVAL);
+  tcp.loop();
+}
+
+class Device : public ModbusDevice {
+ public:
+  void on_modbus_data(uint16_t transaction_id, const std::vector<uint8_t> &data) override { this->responses++; }
+  void on_modbus_timeout(uint16_t transaction_id) override { this->responses++; }
+  uint32_t responses{0};
+};
+
+static bool connect(ModbusTCP &tcp, uint16_t port) {
+  tcp.set_host("127.0.0.1");
+  tcp.set_port(port);
+  tcp.setup();
+  for (int i = 0; i < 1000 && !tcp.client_ready_; i++) {
+    tcp.ensure_tcp_client();
+    tcp.loop();
+    delay(1);
+  }
+  return tcp.client_ready_;
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+  ModbusTCP tcp;
+  Device device;
+  device.set_parent(&tcp);
+  device.set_address(1);
+  tcp.register_device(&device);
+  if (!connect(tcp, bench::sim_port())) {
+    fprintf(stderr, "can't connect to the simulator on port %u\n", bench::sim_port());
+    return 1;
+  }
+
+  // idle: connected, nothing outstanding
+  uint32_t loops = 0;
+  uint32_t recv_calls = tcp.get_recv_calls();
+  double cpu = bench::cpu_us();
+  uint32_t start = millis();
+  while (millis() - start < seconds * 1000) {
+    main_loop(tcp);
+    loops++;
+  }
+  double idle_ns = (bench::cpu_us() - cpu) * 1000 / loops;
+  double idle_loops = loops / seconds;
+  double idle_recv = double(tcp.get_recv_calls() - recv_calls) / seconds;
+
+  // round trip of single requests
+  const int requests = 200;
+  recv_calls = tcp.get_recv_calls();
+  uint32_t round_trip_us = 0;
+  for (int i = 0; i < requests; i++) {
+    uint32_t expected = device.responses + 1;
+    uint32_t sent = micros();
+    device.send(0x03, 1000, 10);
+    while (device.responses != expected) {
+      main_loop(tcp);
+    }
+    round_trip_us += micros() - sent;
+  }
+  double request_recv = double(tcp.get_recv_calls() - recv_calls) / requests;
+
+  // a server closing an idle connection, served by a listener of our own
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_len = sizeof(address);
+  bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+  listen(listener, 1);
+  getsockname(listener, reinterpret_cast<struct sockaddr *>(&address), &address_len);
+
+  ModbusTCP closing;
+  if (!connect(closing, ntohs(address.sin_port))) {
+    fprintf(stderr, "can't connect to the local listener\n");
+    return 1;
+  }
+  int server = accept(listener, nullptr, nullptr);
+  start = millis();
+  while (millis() - start < 300) {
+    main_loop(closing);
+  }
+  close(server);
+  uint32_t closed = millis();
+  while (closing.client_ready_ && millis() - closed < 5000) {
+    main_loop(closing);
+  }
+  close(listener);
+
+  printf("idle loop: %.1f loops/s, %.0f ns cpu, %.1f recv calls/s\n", idle_loops, idle_ns, idle_recv);
+  printf("request:   %.1f us round trip, %.2f recv calls\n", double(round_trip_us) / requests, request_recv);
+  if (closing.client_ready_) {
+    printf("idle close by server: not noticed within 5 s\n");
+  } else {
+    printf("idle close by server: noticed after %u ms\n", millis() - closed);
+  }
+  return 0;
+}
@@ -0,0 +1,76 @@
+// CPU time and heap allocations of the frame trace on the receive path. Synthesized responses are fed straight into
+// the frame parser, no socket involved.
+//
+//   tools/bench/run.sh trace [frames]
+//
+// info: VERBOSE compiled out (ESPHome default build), verbose_off: compiled in but the logger runs at INFO,
+// verbose_on: compiled in and enabled
+//
+// bench-variant: info -DUSE_HOST -DUSE_LOGGER -DESPHOME_LOG_LEVEL=ESPHOME_LOG_LEVEL_INFO
+// bench-variant: verbose_off -DUSE_HOST -DUSE_LOGGER -DESPHOME_LOG_LEVEL=ESPHOME_LOG_LEVEL_VERBOSE -DBENCH_LOGGER_LEVEL=ESPHOME_LOG_LEVEL_INFO
+// bench-variant: verbose_on -DUSE_HOST -DUSE_LOGGER -DESPHOME_LOG_LEVEL=ESPHOME_LOG_LEVEL_VERBOSE -DBENCH_LOGGER_LEVEL=ESPHOME_LOG_LEVEL_VERBOSE
+#include "esphome/components/logger/logger.h"
+#include "esphome/components/modbustcp/modbustcp.h"
+#include "esphome/core/log.h"
+#include "bench.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef BENCH_LOGGER_LEVEL
+#define BENCH_LOGGER_LEVEL ESPHOME_LOG_LEVEL
+#endif
+
+using namespace esphome;
+using namespace esphome::modbustcp;
+
+class Device : public ModbusDevice {
+ public:
+  void on_modbus_data(uint16_t transaction_id, const std::vector<uint8_t> &data) override { this->responses++; }
+  uint32_t responses{0};
+};
+
+/// exposes the receive path of the transport
+class Transport : public ModbusTCP {
+ public:
+  void receive(uint16_t transaction_id, const uint8_t *frame, size_t len) {
+    // no device - the response goes to the one registered for the unit id
+    this->track_transaction_(transaction_id, frame[MBAP_HEADER_SIZE - 1], nullptr);
+    this->process_received_(frame, len);
+  }
+};
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 1000000;
+  logger::global_logger->set_log_level(BENCH_LOGGER_LEVEL);
+
+  Transport tcp;
+  Device device;
+  device.set_parent(&tcp);
+  device.set_address(1);
+  tcp.register_device(&device);
+
+  // read holding registers response with 10 registers
+  uint8_t frame[MBAP_HEADER_SIZE + 2 + 20] = {0, 0, 0, 0, 0, 23, 1, 0x03, 20};
+  for (int i = 0; i < 20; i++) {
+    frame[MBAP_HEADER_SIZE + 2 + i] = i * 13;
+  }
+
+  uint64_t allocations = bench::allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    uint16_t transaction_id = i % 0xFFFF + 1;
+    set_transaction_id(frame, transaction_id);
+    tcp.receive(transaction_id, frame, sizeof(frame));
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  if (device.responses != uint32_t(frames)) {
+    fprintf(stderr, "%u of %d responses dispatched\n", device.responses, frames);
+    return 1;
+  }
+  printf("%.1f ns/frame, %.2f allocations/frame\n", std::chrono::duration<double, std::nano>(end - start).count() / frames,
+         double(bench::allocations - allocations) / frames);
+  return 0;
+}
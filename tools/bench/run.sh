@@ -0,0 +1,55 @@
+#!/bin/sh
+# Build and run one of the benchmarks in this directory.
+#
+#   tools/bench/run.sh <name> [args...]      e.g. tools/bench/run.sh alloc
+#
+# bench_<name>.cpp is compiled with the modbustcp and modbustcp_controller sources of this repository against the
+# minimal ESPHome core in shim/ (g++ only, no ESPHome installation needed). Header lines of the benchmark control
+# the build:
+#
+#   // bench-variant: <label> <compiler flags>   build and run once per variant line
+#   // bench-sim: <modbus_sim.py arguments>     start tools/modbus_sim.py first, its port is in BENCH_SIM_PORT
+#
+# CXX, CXXFLAGS and BENCH_SIM_PORT (default 5020) can be set in the environment.
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 <name> [args...]" >&2
+  exit 2
+fi
+name=$1
+shift
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+repo=$(cd "$bench_dir/../.." && pwd)
+src="$bench_dir/bench_$name.cpp"
+[ -f "$src" ] || { echo "no benchmark $src" >&2; exit 2; }
+
+build=${BENCH_BUILD_DIR:-/tmp/modbustcp-bench}
+mkdir -p "$build/include/esphome/components"
+for component in modbustcp modbustcp_controller; do
+  ln -sfn "$repo/components/$component" "$build/include/esphome/components/$component"
+done
+
+sources="$bench_dir/shim/shim.cpp $repo/components/modbustcp/*.cpp $repo/components/modbustcp_controller/*.cpp
+  $repo/components/modbustcp_controller/*/*.cpp"
+
+export BENCH_SIM_PORT=${BENCH_SIM_PORT:-5020}
+sim_args=$(sed -n 's|^// bench-sim: *||p' "$src")
+if grep -q '^// bench-sim:' "$src"; then
+  # shellcheck disable=SC2086
+  python3 "$repo/tools/modbus_sim.py" --port "$BENCH_SIM_PORT" --report-interval 3600 $sim_args >/dev/null 2>&1 &
+  sim_pid=$!
+  trap 'kill $sim_pid 2>/dev/null' EXIT INT TERM
+  sleep 1
+fi
+
+variants=$(sed -n 's|^// bench-variant: *||p' "$src")
+[ -n "$variants" ] || variants="default"
+echo "$variants" | while read -r label flags; do
+  binary="$build/bench_${name}_$label"
+  # shellcheck disable=SC2086
+  ${CXX:-g++} -std=gnu++17 -O2 ${CXXFLAGS} $flags -I"$bench_dir/shim" -I"$build/include" -o "$binary" "$src" $sources
+  echo "== $name [$label]"
+  "$binary" "$@"
+done
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+
+/// counters and helpers shared by the benchmarks, see tools/bench/run.sh
+namespace bench {
+
+/// heap allocations (operator new) of the whole process and their total size
+extern uint64_t allocations;
+extern uint64_t allocated_bytes;
+/// publish_state() calls of sensors, binary sensors and switches
+extern uint64_t publishes;
+
+/// CPU time consumed by the process in µs (user + system, so socket calls are included)
+double cpu_us();
+/// port of tools/modbus_sim.py, started by run.sh
+uint16_t sim_port();
+
+}  // namespace bench
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+namespace esphome {
+namespace logger {
+class Logger {
+ public:
+  uint8_t level_for(const char *tag) { return this->level_; }
+  void set_log_level(uint8_t level) { this->level_ = level; }
+
+ protected:
+  uint8_t level_{0};
+};
+extern Logger *global_logger;
+}  // namespace logger
+}  // namespace esphome
@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include "esphome/core/optional.h"
+
+namespace esphome {
+namespace switch_ {
+class Switch {
+ public:
+  void publish_state(bool state);
+  std::string get_name() const { return ""; }
+  void turn_on() { this->write_state(true); }
+  void turn_off() { this->write_state(false); }
+  optional<bool> get_initial_state_with_restore_mode() { return {}; }
+  bool state{false};
+
+ protected:
+  virtual void write_state(bool state) = 0;
+  virtual bool assumed_state() { return false; }
+};
+}  // namespace switch_
+}  // namespace esphome
+#define LOG_SWITCH(...)
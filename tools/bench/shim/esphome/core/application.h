@@ -0,0 +1,25 @@
+#pragma once
+#include "esphome/core/component.h"
+
+#include <vector>
+
+namespace esphome {
+
+class Application {
+ public:
+  uint32_t get_config_hash() { return 0; }
+  uint32_t get_loop_component_start_time() const { return millis(); }
+  bool register_socket_fd(int fd);
+  void unregister_socket_fd(int fd);
+  /// readable in the last select_sockets(), like FD_ISSET() on the result of the main loop select()
+  bool is_socket_ready(int fd) const;
+  /// the sleep of the ESPHome main loop between two loop() calls: wait up to timeout_ms for a registered socket
+  void select_sockets(uint32_t timeout_ms);
+
+ protected:
+  std::vector<int> socket_fds_;
+  std::vector<int> ready_fds_;
+};
+extern Application App;
+
+}  // namespace esphome
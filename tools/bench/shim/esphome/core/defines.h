@@ -0,0 +1,2 @@
+#pragma once
+// USE_HOST, USE_LOGGER, USE_SOCKET_SELECT_SUPPORT and ESPHOME_LOG_LEVEL are passed by tools/bench/run.sh
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+namespace esphome {
+
+class ESPPreferenceObject {
+ public:
+  template<typename T> bool save(const T *src) { return true; }
+  template<typename T> bool load(T *dest) { return false; }
+};
+
+class ESPPreferences {
+ public:
+  template<typename T> ESPPreferenceObject make_preference(uint32_t type, bool in_flash) { return {}; }
+  template<typename T> ESPPreferenceObject make_preference(uint32_t type) { return {}; }
+};
+extern ESPPreferences *global_preferences;
+
+}  // namespace esphome
@@ -0,0 +1,7 @@
+#pragma once
+// ESP-IDF flavour of the transport built against POSIX sockets
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
@@ -0,0 +1,177 @@
+// Implementation of the ESPHome core shim used by the benchmarks in tools/bench
+#include "esphome/core/application.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/binary_sensor/binary_sensor.h"
+#include "esphome/components/logger/logger.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/switch/switch.h"
+#include "bench.h"
+
+#include <poll.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdlib>
+#include <thread>
+
+namespace esphome {
+
+Application App;
+
+bool Application::register_socket_fd(int fd) {
+  if (fd < 0) {
+    return false;
+  }
+  this->socket_fds_.push_back(fd);
+  return true;
+}
+void Application::unregister_socket_fd(int fd) {
+  this->socket_fds_.erase(std::remove(this->socket_fds_.begin(), this->socket_fds_.end(), fd),
+                          this->socket_fds_.end());
+  this->ready_fds_.erase(std::remove(this->ready_fds_.begin(), this->ready_fds_.end(), fd), this->ready_fds_.end());
+}
+bool Application::is_socket_ready(int fd) const {
+  return std::find(this->ready_fds_.begin(), this->ready_fds_.end(), fd) != this->ready_fds_.end();
+}
+void Application::select_sockets(uint32_t timeout_ms) {
+  std::vector<struct pollfd> fds;
+  for (int fd : this->socket_fds_) {
+    fds.push_back({fd, POLLIN, 0});
+  }
+  this->ready_fds_.clear();
+  if (poll(fds.data(), fds.size(), timeout_ms) <= 0) {
+    return;
+  }
+  for (auto &pfd : fds) {
+    if (pfd.revents != 0) {
+      this->ready_fds_.push_back(pfd.fd);
+    }
+  }
+}
+ESPPreferences *global_preferences = nullptr;
+
+namespace setup_priority {
+const float AFTER_WIFI = 250.0f;
+const float DATA = 600.0f;
+}  // namespace setup_priority
+const uint32_t SCHEDULER_DONT_RUN = 4294967295UL;
+
+static uint64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+uint32_t millis() { return now_us() / 1000; }
+uint32_t micros() { return now_us(); }
+void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+void esp_log_printf_(int level, const char *tag, int line, const char *format, ...) {
+  // format like the logger does, write out only on request
+  static const bool enabled = getenv("BENCH_LOG") != nullptr;
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (enabled) {
+    fprintf(stderr, "[%d][%s:%d] %s\n", level, tag, line, buffer);
+  }
+}
+
+std::string format_hex_pretty(const uint8_t *data, size_t length) {
+  std::string ret;
+  char buf[4];
+  for (size_t i = 0; i < length; i++) {
+    snprintf(buf, sizeof(buf), i == 0 ? "%02X" : ".%02X", data[i]);
+    ret += buf;
+  }
+  return ret;
+}
+std::string format_hex_pretty(const std::vector<uint8_t> &data) { return format_hex_pretty(data.data(), data.size()); }
+
+std::string str_sprintf(const char *fmt, ...) {
+  char buffer[512];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(buffer, sizeof(buffer), fmt, args);
+  va_end(args);
+  return buffer;
+}
+
+std::array<uint8_t, 2> decode_value(uint16_t value) { return {uint8_t(value >> 8), uint8_t(value)}; }
+
+uint32_t fnv1_hash(const std::string &str) {
+  uint32_t hash = 2166136261UL;
+  for (char c : str) {
+    hash *= 16777619UL;
+    hash ^= c;
+  }
+  return hash;
+}
+
+uint32_t random_uint32() { return rand(); }
+
+namespace logger {
+static Logger logger_instance;
+Logger *global_logger = &logger_instance;
+}  // namespace logger
+
+namespace sensor {
+void Sensor::publish_state(float state) {
+  this->state = state;
+  bench::publishes++;
+}
+}  // namespace sensor
+
+namespace binary_sensor {
+void BinarySensor::publish_state(bool state) {
+  this->state = state;
+  bench::publishes++;
+}
+}  // namespace binary_sensor
+
+namespace switch_ {
+void Switch::publish_state(bool state) {
+  this->state = state;
+  bench::publishes++;
+}
+}  // namespace switch_
+
+}  // namespace esphome
+
+namespace bench {
+
+uint64_t allocations = 0;
+uint64_t allocated_bytes = 0;
+uint64_t publishes = 0;
+
+double cpu_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+uint16_t sim_port() {
+  const char *port = getenv("BENCH_SIM_PORT");
+  return port != nullptr ? atoi(port) : 5020;
+}
+
+}  // namespace bench
+
+// count every heap allocation of the process
+void *operator new(size_t size) {
+  bench::allocations++;
+  bench::allocated_bytes += size;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
@@ -0,0 +1,400 @@
+#!/usr/bin/env python3
+"""Modbus TCP device simulator for load and latency testing.
+
+Serves a register map over Modbus TCP so that ModbusTCP / ModbusTCPController
+(e.g. built for the ESPHome host platform, see examples/host-example.yaml) can
+be polled over loopback. Latency, jitter, exceptions, TCP segmentation and
+response coalescing can be injected to reproduce the behavior of real devices
+and gateways. Requests/s and bytes/s are reported periodically.
+
+Only the Python standard library is used:
+
+    python3 tools/modbus_sim.py --port 5020 --latency 5 --jitter 2
+
+Register map file (JSON), all sections optional. Registers not listed read as
+their own address (holding/input) or as 0 (coils/discrete inputs):
+
+    {
+      "holding": {"1000": 16712, "1001": 0},
+      "input": {"0x3200": 1},
+      "coils": {"0": true},
+      "discrete": {"0x100": false},
+      "holes": {"holding": [[1010, 1019]]}
+    }
+
+Addresses inside "holes" don't exist on the device: any request touching them
+is answered with exception 0x02 (illegal data address).
+"""
+
+from __future__ import annotations
+
+import argparse
+import asyncio
+import json
+import random
+import socket
+import struct
+import sys
+import time
+
+MBAP = struct.Struct(">HHHB")
+
+READ_COILS = 0x01
+READ_DISCRETE_INPUTS = 0x02
+READ_HOLDING_REGISTERS = 0x03
+READ_INPUT_REGISTERS = 0x04
+WRITE_SINGLE_COIL = 0x05
+WRITE_SINGLE_REGISTER = 0x06
+WRITE_MULTIPLE_COILS = 0x0F
+WRITE_MULTIPLE_REGISTERS = 0x10
+MASK_WRITE_REGISTER = 0x16
+READ_WRITE_MULTIPLE_REGISTERS = 0x17
+
+ILLEGAL_FUNCTION = 0x01
+ILLEGAL_DATA_ADDRESS = 0x02
+ILLEGAL_DATA_VALUE = 0x03
+SERVER_DEVICE_BUSY = 0x06
+
+# Modbus application protocol v1.1b3 quantity limits
+MAX_READ_BITS = 2000
+MAX_READ_REGISTERS = 125
+MAX_WRITE_BITS = 1968
+MAX_WRITE_REGISTERS = 123
+
+
+class ModbusException(Exception):
+    def __init__(self, code: int):
+        super().__init__(code)
+        self.code = code
+
+
+def parse_address(value) -> int:
+    return int(value, 0) if isinstance(value, str) else int(value)
+
+
+class RegisterMap:
+    """Storage for the four Modbus data tables."""
+
+    TABLES = ("coils", "discrete", "holding", "input")
+
+    def __init__(self, max_registers: int, max_bits: int):
+        self.tables: dict[str, dict[int, int]] = {name: {} for name in self.TABLES}
+        self.holes: dict[str, list[tuple[int, int]]] = {name: [] for name in self.TABLES}
+        self.max_registers = max_registers
+        self.max_bits = max_bits
+
+    def load(self, path: str) -> None:
+        with open(path, encoding="utf-8") as file:
+            config = json.load(file)
+        for name in self.TABLES:
+            for address, value in config.get(name, {}).items():
+                self.tables[name][parse_address(address)] = int(value)
+        for name, ranges in config.get("holes", {}).items():
+            for first, last in ranges:
+                self.holes[name].append((parse_address(first), parse_address(last)))
+
+    def check(self, table: str, start: int, count: int, limit: int) -> None:
+        if count < 1 or count > limit:
+            raise ModbusException(ILLEGAL_DATA_VALUE)
+        if start + count > 0x10000:
+            raise ModbusException(ILLEGAL_DATA_ADDRESS)
+        for first, last in self.holes[table]:
+            if start <= last and first <= start + count - 1:
+                raise ModbusException(ILLEGAL_DATA_ADDRESS)
+
+    def read_bits(self, table: str, start: int, count: int) -> bytes:
+        self.check(table, start, count, self.max_bits)
+        data = bytearray((count + 7) // 8)
+        for i in range(count):
+            if self.tables[table].get(start + i, 0):
+                data[i // 8] |= 1 << (i % 8)
+        return bytes(data)
+
+    def read_registers(self, table: str, start: int, count: int) -> bytes:
+        self.check(table, start, count, self.max_registers)
+        values = self.tables[table]
+        return b"".join(
+            struct.pack(">H", values.get(start + i, (start + i) & 0xFFFF))
+            for i in range(count)
+        )
+
+    def write_bits(self, start: int, count: int, data: bytes) -> None:
+        self.check("coils", start, count, MAX_WRITE_BITS)
+        for i in range(count):
+            self.tables["coils"][start + i] = (data[i // 8] >> (i % 8)) & 1
+
+    def write_registers(self, start: int, values: list[int]) -> None:
+        self.check("holding", start, len(values), MAX_WRITE_REGISTERS)
+        for i, value in enumerate(values):
+            self.tables["holding"][start + i] = value
+
+
+def handle_pdu(registers: RegisterMap, pdu: bytes) -> bytes:
+    """Execute one request PDU and return the response PDU."""
+    function_code = pdu[0]
+    try:
+        if function_code in (READ_COILS, READ_DISCRETE_INPUTS):
+            start, count = struct.unpack_from(">HH", pdu, 1)
+            table = "coils" if function_code == READ_COILS else "discrete"
+            data = registers.read_bits(table, start, count)
+            return bytes((function_code, len(data))) + data
+        if function_code in (READ_HOLDING_REGISTERS, READ_INPUT_REGISTERS):
+            start, count = struct.unpack_from(">HH", pdu, 1)
+            table = "holding" if function_code == READ_HOLDING_REGISTERS else "input"
+            data = registers.read_registers(table, start, count)
+            return bytes((function_code, len(data))) + data
+        if function_code == WRITE_SINGLE_COIL:
+            address, value = struct.unpack_from(">HH", pdu, 1)
+            if value not in (0x0000, 0xFF00):
+                raise ModbusException(ILLEGAL_DATA_VALUE)
+            registers.write_bits(address, 1, bytes((1 if value else 0,)))
+            return pdu[:5]
+        if function_code == WRITE_SINGLE_REGISTER:
+            address, value = struct.unpack_from(">HH", pdu, 1)
+            registers.write_registers(address, [value])
+            return pdu[:5]
+        if function_code == WRITE_MULTIPLE_COILS:
+            start, count, byte_count = struct.unpack_from(">HHB", pdu, 1)
+            if byte_count != (count + 7) // 8 or len(pdu) < 6 + byte_count:
+                raise ModbusException(ILLEGAL_DATA_VALUE)
+            registers.write_bits(start, count, pdu[6 : 6 + byte_count])
+            return pdu[:5]
+        if function_code == WRITE_MULTIPLE_REGISTERS:
+            start, count, byte_count = struct.unpack_from(">HHB", pdu, 1)
+            if byte_count != count * 2 or len(pdu) < 6 + byte_count:
+                raise ModbusException(ILLEGAL_DATA_VALUE)
+            values = list(struct.unpack_from(f">{count}H", pdu, 6))
+            registers.write_registers(start, values)
+            return pdu[:5]
+        if function_code == MASK_WRITE_REGISTER:
+            address, and_mask, or_mask = struct.unpack_from(">HHH", pdu, 1)
+            current = registers.read_registers("holding", address, 1)
+            (value,) = struct.unpack(">H", current)
+            registers.write_registers(address, [(value & and_mask) | (or_mask & ~and_mask & 0xFFFF)])
+            return pdu[:7]
+        if function_code == READ_WRITE_MULTIPLE_REGISTERS:
+            read_start, read_count, write_start, write_count, byte_count = (
+                struct.unpack_from(">HHHHB", pdu, 1)
+            )
+            if byte_count != write_count * 2 or len(pdu) < 10 + byte_count:
+                raise ModbusException(ILLEGAL_DATA_VALUE)
+            values = list(struct.unpack_from(f">{write_count}H", pdu, 10))
+            # the write is performed before the read
+            registers.write_registers(write_start, values)
+            data = registers.read_registers("holding", read_start, read_count)
+            return bytes((function_code, len(data))) + data
+        raise ModbusException(ILLEGAL_FUNCTION)
+    except struct.error:
+        return bytes((function_code | 0x80, ILLEGAL_DATA_VALUE))
+    except ModbusException as err:
+        return bytes((function_code | 0x80, err.code))
+
+
+class Stats:
+    def __init__(self):
+        self.requests = 0
+        self.exceptions = 0
+        self.busy = 0
+        self.bytes_in = 0
+        self.bytes_out = 0
+        self.max_pending = 0
+
+    def snapshot(self) -> tuple[int, int, int]:
+        return self.requests, self.bytes_in, self.bytes_out
+
+
+class Connection:
+    """One client connection. Requests are answered in arrival order."""
+
+    def __init__(self, args, registers: RegisterMap, stats: Stats, writer):
+        self.args = args
+        self.registers = registers
+        self.stats = stats
+        self.writer = writer
+        self.pending = 0
+        self.slots = asyncio.Semaphore(args.max_concurrent)
+        self.output = bytearray()
+        self.flush_scheduled = False
+        self.last_response = asyncio.get_running_loop().create_future()
+        self.last_response.set_result(None)
+
+    def delay(self) -> float:
+        latency = self.args.latency + random.uniform(-self.args.jitter, self.args.jitter)
+        return max(latency, 0.0) / 1000.0
+
+    def respond_to(self, header: tuple[int, int, int, int], pdu: bytes) -> None:
+        transaction_id, _, _, unit_id = header
+        if self.pending >= self.args.max_concurrent:
+            if self.args.overflow == "drop":
+                self.stats.busy += 1
+                return
+            if self.args.overflow == "busy":
+                self.stats.busy += 1
+                self.send(transaction_id, unit_id, bytes((pdu[0] | 0x80, SERVER_DEVICE_BUSY)))
+                return
+        self.pending += 1
+        self.stats.max_pending = max(self.stats.max_pending, self.pending)
+        # chain on the previous response, so answers keep the request order like a real device
+        previous = self.last_response
+        self.last_response = asyncio.ensure_future(
+            self.process(previous, transaction_id, unit_id, pdu)
+        )
+
+    async def process(self, previous, transaction_id: int, unit_id: int, pdu: bytes) -> None:
+        started = time.monotonic()
+        # requests above --max-concurrent wait for a free slot (overflow == "queue")
+        async with self.slots:
+            await asyncio.sleep(self.delay())
+            if self.args.exception_rate > 0 and random.random() < self.args.exception_rate:
+                response = bytes((pdu[0] | 0x80, self.args.exception_code))
+            else:
+                response = handle_pdu(self.registers, pdu)
+        await previous
+        if response[0] & 0x80:
+            self.stats.exceptions += 1
+        if self.args.verbose:
+            print(
+                f"tid={transaction_id} unit={unit_id} fc=0x{pdu[0]:02X} "
+                f"-> {response.hex()} ({(time.monotonic() - started) * 1000:.1f} ms)"
+            )
+        self.pending -= 1
+        self.send(transaction_id, unit_id, response)
+
+    def send(self, transaction_id: int, unit_id: int, pdu: bytes) -> None:
+        frame = MBAP.pack(transaction_id, 0, len(pdu) + 1, unit_id) + pdu
+        self.stats.bytes_out += len(frame)
+        self.output += frame
+        if self.args.coalesce > 0:
+            # hold responses back and write them together
+            if not self.flush_scheduled:
+                self.flush_scheduled = True
+                asyncio.get_running_loop().call_later(self.args.coalesce / 1000.0, self.flush_soon)
+            return
+        self.flush_soon()
+
+    def flush_soon(self) -> None:
+        self.flush_scheduled = False
+        data = bytes(self.output)
+        self.output.clear()
+        asyncio.ensure_future(self.write(data))
+
+    async def write(self, data: bytes) -> None:
+        if self.writer.is_closing():
+            return
+        segment = self.args.segment if self.args.segment > 0 else len(data)
+        for pos in range(0, len(data), segment):
+            self.writer.write(data[pos : pos + segment])
+            await self.writer.drain()
+            if segment < len(data):
+                # give the TCP stack a chance to send each piece as its own segment
+                await asyncio.sleep(self.args.segment_delay / 1000.0)
+
+
+async def serve_client(args, registers: RegisterMap, stats: Stats, reader, writer) -> None:
+    peer = writer.get_extra_info("peername")
+    print(f"client connected: {peer}")
+    sock = writer.get_extra_info("socket")
+    if sock is not None and args.segment > 0:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    connection = Connection(args, registers, stats, writer)
+    try:
+        while True:
+            header = await reader.readexactly(MBAP.size)
+            transaction_id, protocol_id, length, unit_id = MBAP.unpack(header)
+            if protocol_id != 0 or length < 2 or length > 254:
+                print(f"invalid MBAP header {header.hex()} - closing")
+                break
+            pdu = await reader.readexactly(length - 1)
+            stats.requests += 1
+            stats.bytes_in += len(header) + len(pdu)
+            if args.unit_id is not None and unit_id != args.unit_id:
+                # gateways answer unknown units with exception 0x0B, plain devices stay silent
+                continue
+            connection.respond_to((transaction_id, protocol_id, length, unit_id), pdu)
+    except (asyncio.IncompleteReadError, ConnectionResetError):
+        pass
+    finally:
+        print(f"client disconnected: {peer}")
+        writer.close()
+
+
+async def report(args, stats: Stats) -> None:
+    last = stats.snapshot()
+    last_time = time.monotonic()
+    while True:
+        await asyncio.sleep(args.report_interval)
+        now = time.monotonic()
+        current = stats.snapshot()
+        elapsed = now - last_time
+        requests, bytes_in, bytes_out = (c - p for c, p in zip(current, last))
+        print(
+            f"{requests / elapsed:8.1f} req/s  in {bytes_in / elapsed:9.1f} B/s  "
+            f"out {bytes_out / elapsed:9.1f} B/s  exceptions {stats.exceptions}  "
+            f"busy {stats.busy}  max pending {stats.max_pending}"
+        )
+        last, last_time = current, now
+
+
+async def main(args) -> None:
+    registers = RegisterMap(args.max_registers, args.max_bits)
+    if args.registers:
+        registers.load(args.registers)
+    stats = Stats()
+    server = await asyncio.start_server(
+        lambda r, w: serve_client(args, registers, stats, r, w), args.host, args.port
+    )
+    print(f"Modbus TCP simulator listening on {args.host}:{args.port}")
+    reporter = asyncio.ensure_future(report(args, stats))
+    try:
+        async with server:
+            await server.serve_forever()
+    finally:
+        reporter.cancel()
+
+
+def parse_args(argv):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--host", default="127.0.0.1", help="listen address")
+    parser.add_argument("--port", type=int, default=5020, help="listen port")
+    parser.add_argument("--registers", help="JSON register map, see module docstring")
+    parser.add_argument("--unit-id", type=lambda v: int(v, 0), help="only answer this unit id")
+    parser.add_argument("--latency", type=float, default=0.0, help="response latency in ms")
+    parser.add_argument("--jitter", type=float, default=0.0, help="+/- random latency in ms")
+    parser.add_argument(
+        "--exception-rate", type=float, default=0.0, help="share of requests answered with an exception (0..1)"
+    )
+    parser.add_argument(
+        "--exception-code", type=lambda v: int(v, 0), default=SERVER_DEVICE_BUSY, help="injected exception code"
+    )
+    parser.add_argument(
+        "--segment", type=int, default=0, help="split responses into TCP writes of this many bytes"
+    )
+    parser.add_argument(
+        "--segment-delay", type=float, default=1.0, help="ms between the pieces of a segmented response"
+    )
+    parser.add_argument(
+        "--coalesce", type=float, default=0.0, help="collect responses for this many ms and write them at once"
+    )
+    parser.add_argument(
+        "--max-concurrent", type=int, default=16, help="number of transactions processed at the same time"
+    )
+    parser.add_argument(
+        "--overflow",
+        choices=("queue", "busy", "drop"),
+        default="queue",
+        help="what happens to requests above --max-concurrent",
+    )
+    parser.add_argument(
+        "--max-registers", type=int, default=MAX_READ_REGISTERS, help="max registers per read request"
+    )
+    parser.add_argument("--max-bits", type=int, default=MAX_READ_BITS, help="max coils/inputs per read request")
+    parser.add_argument("--report-interval", type=float, default=5.0, help="statistics interval in seconds")
+    parser.add_argument("-v", "--verbose", action="store_true", help="log every transaction")
+    return parser.parse_args(argv)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main(parse_args(sys.argv[1:])))
+    except KeyboardInterrupt:
+        pass